@@ -1,15 +1,17 @@
 #include <pthread.h>
-#include <semaphore.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
+#include <sys/wait.h>
 #include <unistd.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
 #include <errno.h>
+#include <signal.h>
 
 #include "hive_ipc.h"
+#include "hive_time.h"
 #include "logger/logger.h"
 
 #define handle_error(x)                                                               \
@@ -30,85 +32,172 @@ volatile sig_atomic_t sigint;
 int current_state;
 int life_span;
 int bee_id;
-int bee_time_in_hive;
-int bee_time_outside_hive;
+long long bee_time_in_hive;
+long long bee_time_outside_hive;
+long long crossed_at;
+long long launched_at = 0;
 int been_in_hive_counter = 0;
 
-char *log_tag;
+char log_tag[16];
 
-char *create_log_tag()
+void create_log_tag()
 {
-    char *tag = (char *)malloc(15);
-    sprintf(tag, "BEE_%d", bee_id);
-    return tag;
+    snprintf(log_tag, sizeof(log_tag), "BEE_%d", bee_id);
 }
 
+/**
+ * Sets up the state of a new bee, the bee starts inside when it hatched.
+ */
+void start_bee(int is_inside)
+{
+    crossed_at = monotonic_now();
+    been_in_hive_counter = 0;
+    if (is_inside)
+    {
+        current_state = STATE_INSIDE;
+    }
+    else
+    {
+        current_state = STATE_OUTSIDE;
+    }
+
+    create_log_tag();
+    log(LOG_LEVEL_INFO, log_tag, "end of parsing parameters bee_id=%d life_span=%d bee_time_in_hive=%lldns bee_time_outside_hive=%lldns is_inside=%d", bee_id, life_span, bee_time_in_hive, bee_time_outside_hive, is_inside);
+}
+
+/**
+ * Parses the bee from the command line. The optional launched_at is the time
+ * of CLOCK_MONOTONIC in ns when the hive launched the bee, used to report how
+ * long it took to start.
+ */
 void parse_command_line_arguments(int argc, char *argv[])
 {
     log(LOG_LEVEL_INFO, "BEE", "parsing input parameters");
-    if (argc != 6)
+    if (argc != 6 && argc != 7)
     {
-        printf("Usage: %s <bee_id> <life_span> <bee_time_in_hive> <bee_time_outside_hive> <is_inside>\n", argv[0]);
+        printf("Usage: %s <bee_id> <life_span> <bee_time_in_hive> <bee_time_outside_hive> <is_inside> [launched_at]\n", argv[0]);
+        printf("       %s --pool\n", argv[0]);
         exit(1);
     }
 
     bee_id = atoi(argv[1]);
     life_span = atoi(argv[2]);
-    bee_time_in_hive = atoi(argv[3]);
-    bee_time_outside_hive = atoi(argv[4]);
-    int is_inside = atoi(argv[5]);
-    if (is_inside)
+    if (parse_duration(argv[3], &bee_time_in_hive) == -1 || parse_duration(argv[4], &bee_time_outside_hive) == -1)
     {
-        current_state = STATE_INSIDE;
+        printf("Invalid time, expected a whole number with an optional unit s, ms, us or ns\n");
+        exit(1);
     }
-    else
+    if (argc == 7)
     {
-        current_state = STATE_OUTSIDE;
+        launched_at = atoll(argv[6]);
     }
+    start_bee(atoi(argv[5]));
+}
 
-    log_tag = create_log_tag();
-    log(LOG_LEVEL_INFO, log_tag, "end of parsing parameters bee_id=%d life_span=%d bee_time_in_hive=%d bee_time_outside_hive=%d is_inside=%d", bee_id, life_span, bee_time_in_hive, bee_time_outside_hive, is_inside);
+/**
+ * Takes the bee to run from an assignment of the pool.
+ */
+void assign_bee(const bee_assignment *assignment)
+{
+    bee_id = assignment->id;
+    life_span = assignment->life_span;
+    bee_time_in_hive = assignment->time_in_hive;
+    bee_time_outside_hive = assignment->time_outside_hive;
+    launched_at = assignment->requested_at;
+    start_bee(assignment->starts_in_hive);
 }
 
-void enter_hive()
+/**
+ * Crosses the gate, the hive counts the bee in or out once it is through.
+ *
+ * @param gate_id Gate to cross.
+ * @param delta 1 when entering the hive, -1 when leaving it.
+ * @return 0 once the bee is through, -1 if SIGINT stopped it on the near side.
+ */
+int cross_gate(int gate_id, int delta)
 {
-    log(LOG_LEVEL_INFO, log_tag, "Want to enter the hive, waiting for room");
-    int gate_id = rand() % GATES_NUMBER;
-    handle_error(sem_wait(room_inside_semaphore));
-    handle_error(sem_wait(gate_semaphore[gate_id]));
-    log(LOG_LEVEL_INFO, log_tag, "Entering through the gate %d", gate_id);
+    // The gate threads stop on SIGINT too, a request made now would never be granted.
+    if (sigint)
+    {
+        return -1;
+    }
+    join_gate(gate_id);
+    if (hive_shared->transport == TRANSPORT_SHARED_MEMORY)
+    {
+        log(LOG_LEVEL_INFO, log_tag, "Waiting for gate %d", gate_id);
+        if (cross_gate_shared(gate_id, delta) == -1)
+        {
+            if (sigint)
+            {
+                log(LOG_LEVEL_INFO, log_tag, "Stopped waiting for gate %d due to SIGINT", gate_id);
+                return -1;
+            }
+            handle_error(-1);
+        }
+        log(LOG_LEVEL_INFO, log_tag, "Crossed gate %d", gate_id);
+        return 0;
+    }
+
     gate_message message;
     message.type = USED_GATE_TYPE;
-    message.delta = 1;
+    message.delta = delta;
+    message.pid = getpid();
     log(LOG_LEVEL_INFO, log_tag, "Sending message to gate %d", gate_id);
-    handle_error(msgsnd(gate_message_queue[gate_id], &message, sizeof(int), 0));
+    if (msgsnd(hive_shared->gate_message_queue[gate_id], &message, GATE_MESSAGE_SIZE, 0) == -1)
+    {
+        if (sigint)
+        {
+            log(LOG_LEVEL_INFO, log_tag, "Stopped waiting for gate %d due to SIGINT", gate_id);
+            return -1;
+        }
+        handle_error(-1);
+    }
     log(LOG_LEVEL_INFO, log_tag, "Waiting for ack from gate %d", gate_id);
-    handle_error(msgrcv(gate_message_queue[gate_id], &message, sizeof(int), ACK_TYPE, 0));
+    // Once the message is sent the gate counts the bee, the ack only confirms it.
+    if (msgrcv(hive_shared->gate_message_queue[gate_id], &message, GATE_MESSAGE_SIZE, ACK_TYPE + message.pid, 0) == -1)
+    {
+        handle_error(-1);
+        return 0;
+    }
     log(LOG_LEVEL_INFO, log_tag, "Received ack from gate %d", gate_id);
-    current_state = STATE_INSIDE;
+    return 0;
+}
 
-    handle_error(sem_post(gate_semaphore[gate_id]));
+void enter_hive()
+{
+    log(LOG_LEVEL_INFO, log_tag, "Want to enter the hive, waiting for room");
+    // Without the room the bee must not go near a gate.
+    if (reserve_room(&sigint) == -1 || sigint)
+    {
+        return;
+    }
+    int gate_id = choose_gate(1);
+    log(LOG_LEVEL_INFO, log_tag, "Entering through the gate %d", gate_id);
+    if (cross_gate(gate_id, 1) == -1)
+    {
+        // Still outside, the room goes to another bee.
+        release_room();
+        return;
+    }
+    crossed_at = monotonic_now();
+    current_state = STATE_INSIDE;
     log(LOG_LEVEL_INFO, log_tag, "bee is inside");
 }
 
 void leave_hive()
 {
     log(LOG_LEVEL_INFO, log_tag, "Want to leave the hive");
-    int gate_id = rand() % GATES_NUMBER;
-    handle_error(sem_wait(gate_semaphore[gate_id]));
+    int gate_id = choose_gate(-1);
     log(LOG_LEVEL_INFO, log_tag, "Leaving through the gate %d", gate_id);
-    gate_message message;
-    message.type = USED_GATE_TYPE;
-    message.delta = -1;
-    log(LOG_LEVEL_INFO, log_tag, "Sending message to gate %d", gate_id);
-    handle_error(msgsnd(gate_message_queue[gate_id], &message, sizeof(int), 0));
-    log(LOG_LEVEL_INFO, log_tag, "Waiting for ack from gate %d", gate_id);
-    handle_error(msgrcv(gate_message_queue[gate_id], &message, sizeof(int), ACK_TYPE, 0));
-    log(LOG_LEVEL_INFO, log_tag, "Received ack from gate %d", gate_id);
+    if (cross_gate(gate_id, -1) == -1)
+    {
+        // Still inside, the bee keeps its room.
+        return;
+    }
+    crossed_at = monotonic_now();
     current_state = STATE_OUTSIDE;
     been_in_hive_counter++;
-    handle_error(sem_post(room_inside_semaphore));
-    handle_error(sem_post(gate_semaphore[gate_id]));
+    release_room();
     log(LOG_LEVEL_INFO, log_tag, "bee is outside, been in hive %d/%d times", been_in_hive_counter, life_span);
 }
 
@@ -118,19 +207,19 @@ void bee_lifecycle()
     {
         enter_hive();
     }
-    if (!sigint) sleep(bee_time_in_hive);
+    // Time inside and outside is counted from crossing the gate.
+    if (!sigint) sleep_until(crossed_at + bee_time_in_hive);
     if (current_state == STATE_INSIDE && !sigint)
     {
         leave_hive();
     }
-    if (!sigint) sleep(bee_time_outside_hive);
+    if (!sigint) sleep_until(crossed_at + bee_time_outside_hive);
 }
 
 void cleanup_resources()
 {
-    close_semaphores();
+    close_shared_memory();
     close_logger();
-    free(log_tag);
 }
 
 void try_clean_and_exit_with_error()
@@ -148,16 +237,19 @@ void try_clean_and_exit()
 
 void handle_sigint(int singal)
 {
+    (void)singal;
     sigint = 1;
 }
 
-int main(int argc, char *argv[])
+/**
+ * Lives the life of the current bee until it dies or SIGINT arrives.
+ */
+void run_bee()
 {
-    init_logger();
-    signal(SIGINT, handle_sigint);
-    parse_command_line_arguments(argc, argv);
-    handle_error(initialize_gate_message_queue());
-    handle_error(open_semaphores(1));
+    if (launched_at != 0)
+    {
+        record_bee_launch(current_state == STATE_INSIDE ? LAUNCH_BIRTH : LAUNCH_INITIAL, launched_at, monotonic_now());
+    }
     for (
         been_in_hive_counter = 0;
         been_in_hive_counter < life_span && !sigint;
@@ -174,6 +266,110 @@ int main(int argc, char *argv[])
     {
         log(LOG_LEVEL_INFO, log_tag, "Dead");
     }
+}
+
+/**
+ * Runs the assigned bee, then waits in the pool and runs the next bee the
+ * hive hands to an idle process, so a process is reused instead of exiting.
+ */
+void run_pool_bee(bee_assignment *assignment)
+{
+    while (!sigint)
+    {
+        assign_bee(assignment);
+        run_bee();
+        if (sigint)
+        {
+            break;
+        }
+
+        atomic_fetch_add(&hive_shared->idle_bees, 1);
+        log(LOG_LEVEL_DEBUG, log_tag, "Idle in the pool");
+        if (msgrcv(hive_shared->pool_message_queue, assignment, BEE_ASSIGNMENT_SIZE, POOL_ASSIGN_TYPE, 0) == -1)
+        {
+            handle_error(-1);
+            break;
+        }
+    }
+    try_clean_and_exit();
+}
 
+/**
+ * Reaps the bees of the fork server. The hive only sees the fork server, so a
+ * bee failing while the hive runs makes the fork server fail with the status
+ * of the bee, which stops the hive as a failing bee process does.
+ */
+void handle_sigchld(int signal)
+{
+    (void)signal;
+    int saved_errno = errno;
+    int status;
+    while (waitpid(-1, &status, WNOHANG) > 0)
+    {
+        if (!sigint && (WIFSIGNALED(status) || WEXITSTATUS(status) != 0))
+        {
+            _exit(WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status));
+        }
+    }
+    errno = saved_errno;
+}
+
+/**
+ * Forks a new bee for every POOL_SPAWN_TYPE request of the hive. The server
+ * is started once, so bees skip exec, dynamic linking and the setup of the
+ * logger and of the shared memory, the server reaps them in handle_sigchld.
+ */
+void run_fork_server()
+{
+    struct sigaction reap = {.sa_handler = handle_sigchld, .sa_flags = SA_NOCLDSTOP};
+    sigemptyset(&reap.sa_mask);
+    sigaction(SIGCHLD, &reap, NULL);
+    snprintf(log_tag, sizeof(log_tag), "BEE_POOL");
+    log(LOG_LEVEL_INFO, log_tag, "Fork server started");
+
+    while (!sigint)
+    {
+        bee_assignment assignment;
+        if (msgrcv(hive_shared->pool_message_queue, &assignment, BEE_ASSIGNMENT_SIZE, POOL_SPAWN_TYPE, 0) == -1)
+        {
+            // A reaped bee interrupts the wait too.
+            if (errno != EINTR)
+            {
+                handle_error(-1);
+            }
+            continue;
+        }
+
+        pid_t pid = fork();
+        if (pid == 0)
+        {
+            signal(SIGCHLD, SIG_DFL);
+            reinit_logger_after_fork();
+            srand(getpid());
+            run_pool_bee(&assignment);
+        }
+        handle_error(pid);
+    }
+
+    log(LOG_LEVEL_INFO, log_tag, "Fork server exiting");
+    try_clean_and_exit();
+}
+
+int main(int argc, char *argv[])
+{
+    init_logger();
+    // No SA_RESTART, a bee waiting for a gate or for room must wake up on SIGINT.
+    struct sigaction action = {.sa_handler = handle_sigint};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    if (argc == 2 && strcmp(argv[1], "--pool") == 0)
+    {
+        handle_error(open_shared_memory(0));
+        run_fork_server();
+    }
+    parse_command_line_arguments(argc, argv);
+    srand(getpid());
+    handle_error(open_shared_memory(0));
+    run_bee();
     try_clean_and_exit();
 }
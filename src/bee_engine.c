@@ -0,0 +1,416 @@
+#include "bee_engine.h"
+#include "hive_ipc.h"
+#include "timer_wheel.h"
+#include "logger/logger.h"
+
+#include <pthread.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stddef.h>
+
+#define log_tag "BEE_ENGINE"
+
+#define TASKS_PER_CHUNK 1024
+
+/**
+ * How often bees waiting for room try again, room may also be freed by other
+ * processes or by a larger capacity.
+ */
+#define ROOM_RETRY_INTERVAL_NS 100000000LL
+
+#define STEP_WANT_ENTER 0
+#define STEP_WAIT_ROOM 1
+#define STEP_ENTERED 2
+#define STEP_WANT_LEAVE 3
+#define STEP_LEFT 4
+
+/**
+ * Single bee run by the engine. A bee is always in exactly one place: the
+ * ready queue, the queue of a gate, the queue of bees waiting for room or the
+ * timer wheel, the next pointer links it into the queues.
+ */
+typedef struct bee_task
+{
+    struct bee_task *next;
+    timer_entry timer;              /* wakes the bee up after its time inside or outside */
+    int id;
+    long long time_in_hive;         /* in ns, as the time outside */
+    long long time_outside_hive;
+    int life_span;
+    int visits;
+    int step;                       /* one of the STEP_ values, what the bee does next */
+    char log_tag_buffer[16];
+} bee_task;
+
+typedef struct
+{
+    bee_task *head;
+    bee_task *tail;
+} task_queue;
+
+/**
+ * Bees waiting for a gate, by direction: index 1 holds entering bees, index 0
+ * leaving bees.
+ */
+typedef struct
+{
+    pthread_mutex_t lock;
+    task_queue waiting[2];
+    int count[2];
+    gate_schedule schedule;
+} engine_gate;
+
+/**
+ * Memory of the bees, allocated in chunks that are only freed when the engine
+ * stops. Dead bees are reused for new ones.
+ */
+typedef struct task_chunk
+{
+    struct task_chunk *next;
+    bee_task tasks[TASKS_PER_CHUNK];
+} task_chunk;
+
+static volatile int running = 0;
+
+static pthread_mutex_t ready_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t ready_cond = PTHREAD_COND_INITIALIZER;
+static task_queue ready_queue;
+
+static pthread_mutex_t room_lock = PTHREAD_MUTEX_INITIALIZER;
+static task_queue room_queue;
+
+static timer_entry room_retry_timer;
+
+static pthread_mutex_t memory_lock = PTHREAD_MUTEX_INITIALIZER;
+static task_chunk *chunks;
+static bee_task *free_tasks;
+
+static engine_gate gates[MAX_GATES];
+
+static pthread_t *worker_threads;
+static int worker_count = 0;
+
+static void push_task(task_queue *queue, bee_task *task)
+{
+    task->next = NULL;
+    if (queue->tail)
+    {
+        queue->tail->next = task;
+    }
+    else
+    {
+        queue->head = task;
+    }
+    queue->tail = task;
+}
+
+static bee_task *pop_task(task_queue *queue)
+{
+    bee_task *task = queue->head;
+    if (task)
+    {
+        queue->head = task->next;
+        if (queue->head == NULL)
+        {
+            queue->tail = NULL;
+        }
+    }
+    return task;
+}
+
+/**
+ * Hands the bee to a worker thread.
+ */
+static void make_ready(bee_task *task)
+{
+    pthread_mutex_lock(&ready_lock);
+    push_task(&ready_queue, task);
+    pthread_cond_signal(&ready_cond);
+    pthread_mutex_unlock(&ready_lock);
+}
+
+static void wake_task(timer_entry *entry)
+{
+    make_ready((bee_task *)((char *)entry - offsetof(bee_task, timer)));
+}
+
+/**
+ * Puts the bee to sleep on the timer wheel, then it continues with the step.
+ */
+static void sleep_task(bee_task *task, long long duration, int step)
+{
+    task->step = step;
+    schedule_timer(&task->timer, duration, wake_task);
+}
+
+/**
+ * Lets the bees waiting for room try again.
+ *
+ * @param all - 1 to wake all of them, 0 to wake one
+ */
+static void wake_room_waiters(int all)
+{
+    pthread_mutex_lock(&room_lock);
+    bee_task *task;
+    do
+    {
+        task = pop_task(&room_queue);
+        if (task)
+        {
+            make_ready(task);
+        }
+    } while (task && all);
+    pthread_mutex_unlock(&room_lock);
+}
+
+/**
+ * Reserves room for the bee or queues it until some room is released.
+ *
+ * @return 1 if the room is reserved, 0 if the bee is queued
+ */
+static int reserve_task_room(bee_task *task)
+{
+    pthread_mutex_lock(&room_lock);
+    int reserved = try_reserve_room() == 0;
+    if (!reserved)
+    {
+        push_task(&room_queue, task);
+    }
+    pthread_mutex_unlock(&room_lock);
+    return reserved;
+}
+
+/**
+ * Queues the bee at a gate and lets through every bee waiting there, one at a
+ * time in the order chosen by next_direction. Crossing takes no time, so the
+ * gate is free again as soon as the bees are through.
+ */
+static void request_gate(bee_task *task, int delta)
+{
+    int gate_id = choose_gate(delta);
+    engine_gate *gate = &gates[gate_id];
+    join_gate(gate_id);
+    log(LOG_LEVEL_INFO, task->log_tag_buffer, "%s through the gate %d", delta == 1 ? "Entering" : "Leaving", gate_id);
+
+    pthread_mutex_lock(&gate->lock);
+    push_task(&gate->waiting[delta == 1], task);
+    gate->count[delta == 1]++;
+    int direction;
+    while ((direction = next_direction(&gate->schedule, gate->count[1], gate->count[0])) != 0)
+    {
+        int way = direction == 1;
+        bee_task *passing = pop_task(&gate->waiting[way]);
+        gate->count[way]--;
+        atomic_fetch_add_explicit(&hive_shared->gates[gate_id].bees_delta, direction, memory_order_relaxed);
+        pass_gate(gate_id, direction);
+        passing->step = direction == 1 ? STEP_ENTERED : STEP_LEFT;
+        make_ready(passing);
+    }
+    pthread_mutex_unlock(&gate->lock);
+}
+
+static void free_task(bee_task *task)
+{
+    pthread_mutex_lock(&memory_lock);
+    task->next = free_tasks;
+    free_tasks = task;
+    pthread_mutex_unlock(&memory_lock);
+}
+
+/**
+ * Runs the next step of the bee's lifecycle, the same as bee_lifecycle in
+ * bee.c but without blocking the worker.
+ */
+static void run_task(bee_task *task)
+{
+    switch (task->step)
+    {
+    case STEP_WANT_ENTER:
+        log(LOG_LEVEL_INFO, task->log_tag_buffer, "Want to enter the hive, waiting for room");
+        task->step = STEP_WAIT_ROOM;
+        // fall through
+    case STEP_WAIT_ROOM:
+        if (reserve_task_room(task))
+        {
+            request_gate(task, 1);
+        }
+        break;
+    case STEP_ENTERED:
+        log(LOG_LEVEL_INFO, task->log_tag_buffer, "bee is inside");
+        sleep_task(task, task->time_in_hive, STEP_WANT_LEAVE);
+        break;
+    case STEP_WANT_LEAVE:
+        log(LOG_LEVEL_INFO, task->log_tag_buffer, "Want to leave the hive");
+        request_gate(task, -1);
+        break;
+    case STEP_LEFT:
+        task->visits++;
+        release_room();
+        wake_room_waiters(0);
+        log(LOG_LEVEL_INFO, task->log_tag_buffer, "bee is outside, been in hive %d/%d times", task->visits, task->life_span);
+        if (task->visits >= task->life_span)
+        {
+            log(LOG_LEVEL_INFO, task->log_tag_buffer, "Dead");
+            free_task(task);
+            break;
+        }
+        sleep_task(task, task->time_outside_hive, STEP_WANT_ENTER);
+        break;
+    }
+}
+
+static void *worker_thread_function(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&ready_lock);
+    while (running)
+    {
+        bee_task *task = pop_task(&ready_queue);
+        if (task == NULL)
+        {
+            pthread_cond_wait(&ready_cond, &ready_lock);
+            continue;
+        }
+        pthread_mutex_unlock(&ready_lock);
+        run_task(task);
+        pthread_mutex_lock(&ready_lock);
+    }
+    pthread_mutex_unlock(&ready_lock);
+    return NULL;
+}
+
+/**
+ * Periodically lets all the bees waiting for room try again.
+ */
+static void retry_room(timer_entry *entry)
+{
+    wake_room_waiters(1);
+    if (running)
+    {
+        schedule_timer(entry, ROOM_RETRY_INTERVAL_NS, retry_room);
+    }
+}
+
+/**
+ * Takes a task for a new bee, allocating a new chunk when there is no dead
+ * bee to reuse.
+ */
+static bee_task *allocate_task()
+{
+    pthread_mutex_lock(&memory_lock);
+    if (free_tasks == NULL)
+    {
+        task_chunk *chunk = malloc(sizeof(task_chunk));
+        if (chunk == NULL)
+        {
+            pthread_mutex_unlock(&memory_lock);
+            return NULL;
+        }
+
+        chunk->next = chunks;
+        chunks = chunk;
+        for (int i = TASKS_PER_CHUNK - 1; i >= 0; i--)
+        {
+            chunk->tasks[i].next = free_tasks;
+            free_tasks = &chunk->tasks[i];
+        }
+    }
+    bee_task *task = free_tasks;
+    free_tasks = task->next;
+    pthread_mutex_unlock(&memory_lock);
+    return task;
+}
+
+int start_bee_engine(int workers)
+{
+    if (workers <= 0)
+    {
+        long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = cpus > 0 ? cpus : 1;
+    }
+    worker_threads = malloc(workers * sizeof(pthread_t));
+    if (worker_threads == NULL)
+    {
+        log(LOG_LEVEL_ERROR, log_tag, "ERROR %s at %s\n", strerror(errno), __func__);
+        return -1;
+    }
+
+    for (int i = 0; i < MAX_GATES; i++)
+    {
+        pthread_mutex_init(&gates[i].lock, NULL);
+        gates[i].schedule.direction = -1;
+    }
+
+    running = 1;
+    for (worker_count = 0; worker_count < workers; worker_count++)
+    {
+        if (pthread_create(&worker_threads[worker_count], NULL, worker_thread_function, NULL) != 0)
+        {
+            log(LOG_LEVEL_ERROR, log_tag, "ERROR %s at %s\n", strerror(errno), __func__);
+            stop_bee_engine();
+            return -1;
+        }
+    }
+    schedule_timer(&room_retry_timer, ROOM_RETRY_INTERVAL_NS, retry_room);
+    log(LOG_LEVEL_INFO, log_tag, "Started %d workers", workers);
+    return 0;
+}
+
+int spawn_bee_task(bee_config bee)
+{
+    bee_task *task = allocate_task();
+    if (task == NULL)
+    {
+        log(LOG_LEVEL_ERROR, log_tag, "No memory for bee %d", bee.id + 1);
+        return -1;
+    }
+    task->id = bee.id + 1;
+    task->time_in_hive = bee.time_in_hive;
+    task->time_outside_hive = bee.time_in_hive;
+    task->life_span = bee.life_span;
+    task->visits = 0;
+    snprintf(task->log_tag_buffer, sizeof(task->log_tag_buffer), "BEE_%d", task->id);
+
+    if (bee.starts_in_hive)
+    {
+        task->step = STEP_ENTERED;
+    }
+    else
+    {
+        task->step = STEP_WANT_ENTER;
+    }
+    make_ready(task);
+    return 0;
+}
+
+void stop_bee_engine()
+{
+    if (!running)
+    {
+        return;
+    }
+    running = 0;
+
+    pthread_mutex_lock(&ready_lock);
+    pthread_cond_broadcast(&ready_cond);
+    pthread_mutex_unlock(&ready_lock);
+    for (int i = 0; i < worker_count; i++)
+    {
+        pthread_join(worker_threads[i], NULL);
+    }
+
+    while (chunks)
+    {
+        task_chunk *chunk = chunks;
+        chunks = chunk->next;
+        free(chunk);
+    }
+    free(worker_threads);
+    worker_threads = NULL;
+    free_tasks = NULL;
+    ready_queue.head = ready_queue.tail = NULL;
+    room_queue.head = room_queue.tail = NULL;
+}
@@ -0,0 +1,52 @@
+#ifndef BEE_ENGINE_H
+#define BEE_ENGINE_H
+
+/**
+ * How the hive runs its bees. ENGINE_PROCESS launches every bee as a separate
+ * ./bin/bee process, ENGINE_TASK runs the bees as tasks on a small pool of
+ * worker threads inside the hive. ENGINE_POOL hands the bees to a fork server
+ * and to idle bee processes, see ./bin/bee --pool.
+ */
+#define ENGINE_PROCESS 0
+#define ENGINE_TASK 1
+#define ENGINE_POOL 2
+
+/**
+ * Represents the configuration of a bee.
+ */
+typedef struct
+{
+    int id;
+    long long time_in_hive;                         /* in ns */
+    int life_span;
+    int starts_in_hive;
+} bee_config;
+
+/**
+ * Starts the worker threads that run the bee tasks. The bees sleep on the
+ * timer wheel of the hive, so this should be used after start_timer_service,
+ * open_shared_memory and initialize_gate_message_queues.
+ *
+ * @param workers - number of worker threads, 0 starts one per CPU
+ * @return int - 0 if the engine was started, -1 otherwise
+ */
+int start_bee_engine(int workers);
+
+/**
+ * Adds a bee to the engine. The bee follows the same lifecycle as ./bin/bee:
+ * it reserves room, crosses a gate, stays inside, crosses a gate again and
+ * dies after life_span visits.
+ *
+ * @param bee - configuration of the bee, a bee that starts in the hive must
+ *        already hold its room
+ * @return int - 0 if the bee was added, -1 if there was no memory for it
+ */
+int spawn_bee_task(bee_config bee);
+
+/**
+ * Stops the engine and frees all the bees. The timer service must be stopped
+ * first so that no timer fires for a freed bee.
+ */
+void stop_bee_engine();
+
+#endif
@@ -0,0 +1,78 @@
+#include <stdio.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "logger/logger.h"
+#include "hive_ipc.h"
+
+#define log_tag "BEEKEEPER"
+
+/**
+ * Prints the capacity of the hive and how many bees hold room in it. The
+ * count may exceed the capacity for a while after frames were removed.
+ */
+void report_hive_state()
+{
+    uint64_t occupancy = read_occupancy();
+    printf("Capacity %u of at most %u, %u bees hold room, %d bees inside\n",
+           OCCUPANCY_CAPACITY(occupancy), hive_shared->max_capacity, OCCUPANCY_COUNT(occupancy),
+           count_bees_inside());
+}
+
+/**
+ * Tells the hive to add or remove frames. The main thread of the hive takes
+ * the signal and changes its capacity, see scale_room_capacity.
+ */
+int send_frames_signal(int signal)
+{
+    if (kill(hive_shared->hive_pid, signal) == -1)
+    {
+        log(LOG_LEVEL_ERROR, log_tag, "ERROR %s at %s\n", strerror(errno), __func__);
+        return -1;
+    }
+    log(LOG_LEVEL_INFO, log_tag, "%s frames of hive %d",
+        signal == ADD_FRAMES_SIGNAL ? "Added" : "Removed", hive_shared->hive_pid);
+    return 0;
+}
+
+/**
+ * Adds frames to the running hive (add), removes them (remove) or reports
+ * its state (status).
+ */
+int main(int argc, char *argv[])
+{
+    if (argc != 2 || (strcmp(argv[1], "add") != 0 && strcmp(argv[1], "remove") != 0 && strcmp(argv[1], "status") != 0))
+    {
+        fprintf(stderr, "Usage: %s add|remove|status\n", argv[0]);
+        return 1;
+    }
+
+    init_logger();
+    if (open_shared_memory(0) == -1)
+    {
+        fprintf(stderr, "The hive is not running\n");
+        close_logger();
+        return 1;
+    }
+
+    int result = 0;
+    if (strcmp(argv[1], "add") == 0)
+    {
+        result = send_frames_signal(ADD_FRAMES_SIGNAL);
+    }
+    else if (strcmp(argv[1], "remove") == 0)
+    {
+        result = send_frames_signal(REMOVE_FRAMES_SIGNAL);
+    }
+    else
+    {
+        report_hive_state();
+    }
+
+    close_shared_memory();
+    close_logger();
+    return result == -1 ? 1 : 0;
+}
@@ -0,0 +1,472 @@
+#define _GNU_SOURCE
+#include "child_reaper.h"
+#include "logger/logger.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#define log_tag "REAPER"
+
+#define INITIAL_TABLE_CAPACITY 1024
+#define MAX_EVENTS 64
+
+/**
+ * Tags of the epoll events, a pidfd event carries the pid in the rest of the
+ * data.
+ */
+#define EVENT_STOP 0
+#define EVENT_SIGCHLD 1
+#define EVENT_PIDFD 2
+#define EVENT_TAG_BITS 2
+
+/**
+ * Table of the children by pid, open addressing with linear probing. A slot
+ * with pid 0 is free. Guarded by table_lock.
+ */
+static pthread_mutex_t table_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t table_empty = PTHREAD_COND_INITIALIZER;
+static child_process *table;
+static int table_capacity = 0;
+static int table_count = 0;
+
+/**
+ * Children without a pidfd when pidfds are used, because pidfd_open failed
+ * for them, for example with EMFILE. They are collected on SIGCHLD instead.
+ * Guarded by table_lock.
+ */
+static pid_t *fallback_pids;
+static int fallback_capacity = 0;
+static int fallback_count = 0;
+
+static int epoll_fd = -1;
+static int stop_fd = -1;
+static int signal_fd = -1;
+static int use_pidfd = 0;
+static sigset_t original_mask;
+static pid_t owner = 0;
+static pthread_t reaper_thread;
+static void (*exit_callback)(child_process child, int status);
+
+static int pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+    return syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+static int slot_of(pid_t pid)
+{
+    return ((uint32_t)pid * 2654435761u) & (table_capacity - 1);
+}
+
+/**
+ * Makes room in the table for one more child, table_lock must be held.
+ *
+ * @return 0 if there is room, -1 if there was no memory for it
+ */
+static int reserve_child()
+{
+    if (2 * (table_count + 1) > table_capacity)
+    {
+        int old_capacity = table_capacity;
+        child_process *old_table = table;
+        int capacity = old_capacity ? 2 * old_capacity : INITIAL_TABLE_CAPACITY;
+        child_process *resized = calloc(capacity, sizeof(child_process));
+        if (resized == NULL)
+        {
+            return -1;
+        }
+        table = resized;
+        table_capacity = capacity;
+        for (int i = 0; i < old_capacity; i++)
+        {
+            if (old_table[i].pid != 0)
+            {
+                int slot = slot_of(old_table[i].pid);
+                while (table[slot].pid != 0)
+                {
+                    slot = (slot + 1) & (table_capacity - 1);
+                }
+                table[slot] = old_table[i];
+            }
+        }
+        free(old_table);
+    }
+    return 0;
+}
+
+/**
+ * Adds the child to the table, table_lock must be held and the room made by
+ * reserve_child.
+ */
+static void insert_child(child_process child)
+{
+    int slot = slot_of(child.pid);
+    while (table[slot].pid != 0)
+    {
+        slot = (slot + 1) & (table_capacity - 1);
+    }
+    table[slot] = child;
+    table_count++;
+}
+
+/**
+ * Takes the child out of the table, table_lock must be held.
+ *
+ * @return 1 if the child was in the table, 0 otherwise
+ */
+static int remove_child(pid_t pid, child_process *child)
+{
+    if (table_capacity == 0)
+    {
+        return 0;
+    }
+    int slot = slot_of(pid);
+    while (table[slot].pid != pid)
+    {
+        if (table[slot].pid == 0)
+        {
+            return 0;
+        }
+        slot = (slot + 1) & (table_capacity - 1);
+    }
+    *child = table[slot];
+    table_count--;
+
+    // Shift back the entries that probed past the freed slot.
+    int hole = slot;
+    for (int next = (hole + 1) & (table_capacity - 1); table[next].pid != 0; next = (next + 1) & (table_capacity - 1))
+    {
+        int home = slot_of(table[next].pid);
+        if (((next - home) & (table_capacity - 1)) >= ((next - hole) & (table_capacity - 1)))
+        {
+            table[hole] = table[next];
+            hole = next;
+        }
+    }
+    table[hole].pid = 0;
+    return 1;
+}
+
+/**
+ * Makes room for one more child collected on SIGCHLD, table_lock must be
+ * held.
+ *
+ * @return 0 if there is room, -1 if there was no memory for it
+ */
+static int reserve_fallback()
+{
+    if (fallback_count == fallback_capacity)
+    {
+        int capacity = fallback_capacity ? 2 * fallback_capacity : 64;
+        pid_t *resized = realloc(fallback_pids, capacity * sizeof(pid_t));
+        if (resized == NULL)
+        {
+            return -1;
+        }
+        fallback_pids = resized;
+        fallback_capacity = capacity;
+    }
+    return 0;
+}
+
+/**
+ * Adds the child to the children collected on SIGCHLD, table_lock must be
+ * held and the room made by reserve_fallback.
+ */
+static void add_fallback(pid_t pid)
+{
+    fallback_pids[fallback_count++] = pid;
+}
+
+/**
+ * Takes the child out of the children collected on SIGCHLD, table_lock must
+ * be held.
+ */
+static void remove_fallback(pid_t pid)
+{
+    for (int i = 0; i < fallback_count; i++)
+    {
+        if (fallback_pids[i] == pid)
+        {
+            fallback_pids[i] = fallback_pids[--fallback_count];
+            return;
+        }
+    }
+}
+
+/**
+ * Removes the collected child from the table and reports it.
+ */
+static void child_exited(pid_t pid, int status)
+{
+    child_process child = {.pid = pid, .kind = CHILD_BEE, .bee_id = 0, .pidfd = -1};
+    pthread_mutex_lock(&table_lock);
+    int known = remove_child(pid, &child);
+    if (known && child.pidfd == -1 && use_pidfd)
+    {
+        remove_fallback(pid);
+    }
+    if (table_count == 0)
+    {
+        pthread_cond_broadcast(&table_empty);
+    }
+    pthread_mutex_unlock(&table_lock);
+
+    if (!known)
+    {
+        log(LOG_LEVEL_ERROR, log_tag, "Collected unknown child %d", pid);
+        return;
+    }
+    if (child.pidfd != -1)
+    {
+        close(child.pidfd);
+    }
+    exit_callback(child, status);
+}
+
+/**
+ * Collects the children without a pidfd that exited. The others are left to
+ * their pidfd events.
+ */
+static void collect_fallback_children()
+{
+    for (int i = 0;; i++)
+    {
+        pthread_mutex_lock(&table_lock);
+        if (i >= fallback_count)
+        {
+            pthread_mutex_unlock(&table_lock);
+            return;
+        }
+        pid_t pid = fallback_pids[i];
+        pthread_mutex_unlock(&table_lock);
+
+        int status;
+        if (waitpid(pid, &status, WNOHANG) > 0)
+        {
+            // The last child took its place in the list.
+            child_exited(pid, status);
+            i--;
+        }
+    }
+}
+
+static void *reaper_thread_function(void *arg)
+{
+    (void)arg;
+    struct epoll_event events[MAX_EVENTS];
+    for (;;)
+    {
+        int count = epoll_wait(epoll_fd, events, MAX_EVENTS, -1);
+        if (count == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            log(LOG_LEVEL_ERROR, log_tag, "ERROR %s at %s\n", strerror(errno), __func__);
+            return NULL;
+        }
+
+        for (int i = 0; i < count; i++)
+        {
+            uint64_t data = events[i].data.u64;
+            int status;
+            switch (data & ((1 << EVENT_TAG_BITS) - 1))
+            {
+            case EVENT_STOP:
+                return NULL;
+            case EVENT_SIGCHLD:
+            {
+                struct signalfd_siginfo info;
+                while (read(signal_fd, &info, sizeof(info)) == sizeof(info))
+                {
+                }
+                if (use_pidfd)
+                {
+                    collect_fallback_children();
+                    break;
+                }
+                // Signals of several children may have merged into one.
+                pid_t pid;
+                while ((pid = waitpid(-1, &status, WNOHANG)) > 0)
+                {
+                    child_exited(pid, status);
+                }
+                break;
+            }
+            case EVENT_PIDFD:
+            {
+                pid_t pid = data >> EVENT_TAG_BITS;
+                if (waitpid(pid, &status, WNOHANG) > 0)
+                {
+                    child_exited(pid, status);
+                }
+                break;
+            }
+            }
+        }
+    }
+}
+
+int start_child_reaper(void (*on_exit)(child_process child, int status))
+{
+    exit_callback = on_exit;
+    owner = getpid();
+
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    pthread_sigmask(SIG_BLOCK, &mask, &original_mask);
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    stop_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if (epoll_fd == -1 || stop_fd == -1)
+    {
+        log(LOG_LEVEL_ERROR, log_tag, "ERROR %s at %s\n", strerror(errno), __func__);
+        return -1;
+    }
+    struct epoll_event event = {.events = EPOLLIN, .data.u64 = EVENT_STOP};
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, stop_fd, &event);
+
+    int probe = pidfd_open(getpid());
+    use_pidfd = probe != -1;
+    if (use_pidfd)
+    {
+        close(probe);
+    }
+
+    // Also a backstop with pidfds, for the children whose pidfd could not be opened.
+    signal_fd = signalfd(-1, &mask, SFD_CLOEXEC | SFD_NONBLOCK);
+    if (signal_fd == -1)
+    {
+        log(LOG_LEVEL_ERROR, log_tag, "ERROR %s at %s\n", strerror(errno), __func__);
+        return -1;
+    }
+    event.data.u64 = EVENT_SIGCHLD;
+    epoll_ctl(epoll_fd, EPOLL_CTL_ADD, signal_fd, &event);
+
+    if (pthread_create(&reaper_thread, NULL, reaper_thread_function, NULL) != 0)
+    {
+        log(LOG_LEVEL_ERROR, log_tag, "ERROR %s at %s\n", strerror(errno), __func__);
+        return -1;
+    }
+    log(LOG_LEVEL_INFO, log_tag, "Collecting children with %s", use_pidfd ? "pidfd" : "signalfd");
+    return 0;
+}
+
+pid_t fork_child(int kind, int bee_id)
+{
+    // Held across fork, so the child is in the table before it can be collected.
+    pthread_mutex_lock(&table_lock);
+    // A child that can not be tracked would never be collected, so the room is made first.
+    if (reserve_child() == -1 || (use_pidfd && reserve_fallback() == -1))
+    {
+        pthread_mutex_unlock(&table_lock);
+        log(LOG_LEVEL_ERROR, log_tag, "No memory to track a new child");
+        errno = ENOMEM;
+        return -1;
+    }
+    pid_t pid = fork();
+    if (pid == 0)
+    {
+        pthread_sigmask(SIG_SETMASK, &original_mask, NULL);
+        return 0;
+    }
+    if (pid == -1)
+    {
+        pthread_mutex_unlock(&table_lock);
+        return -1;
+    }
+
+    child_process child = {.pid = pid, .kind = kind, .bee_id = bee_id, .pidfd = -1};
+    int pidfd_error = 0;
+    if (use_pidfd)
+    {
+        child.pidfd = pidfd_open(pid);
+        pidfd_error = errno;
+    }
+    insert_child(child);
+    if (use_pidfd && child.pidfd == -1)
+    {
+        log(LOG_LEVEL_INFO, log_tag, "No pidfd for child %d (%s), collecting it on SIGCHLD", pid, strerror(pidfd_error));
+        add_fallback(pid);
+    }
+    pthread_mutex_unlock(&table_lock);
+
+    if (child.pidfd != -1)
+    {
+        struct epoll_event event = {.events = EPOLLIN, .data.u64 = ((uint64_t)pid << EVENT_TAG_BITS) | EVENT_PIDFD};
+        epoll_ctl(epoll_fd, EPOLL_CTL_ADD, child.pidfd, &event);
+    }
+    return pid;
+}
+
+int wait_for_children(long long timeout_ns)
+{
+    if (owner != getpid())
+    {
+        return 0;
+    }
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += timeout_ns / 1000000000LL;
+    deadline.tv_nsec += timeout_ns % 1000000000LL;
+    if (deadline.tv_nsec >= 1000000000L)
+    {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000L;
+    }
+
+    int result = 0;
+    pthread_mutex_lock(&table_lock);
+    while (table_count > 0 && result != ETIMEDOUT)
+    {
+        result = pthread_cond_timedwait(&table_empty, &table_lock, &deadline);
+    }
+    int remaining = table_count;
+    pthread_mutex_unlock(&table_lock);
+    return remaining > 0 ? -1 : 0;
+}
+
+void stop_child_reaper()
+{
+    if (owner != getpid())
+    {
+        return;
+    }
+    uint64_t one = 1;
+    if (write(stop_fd, &one, sizeof(one)) == sizeof(one))
+    {
+        pthread_join(reaper_thread, NULL);
+    }
+    close(stop_fd);
+    close(epoll_fd);
+    close(signal_fd);
+    signal_fd = -1;
+    free(table);
+    table = NULL;
+    free(fallback_pids);
+    fallback_pids = NULL;
+    fallback_capacity = 0;
+    fallback_count = 0;
+    table_capacity = 0;
+    table_count = 0;
+    owner = 0;
+}
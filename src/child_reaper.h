@@ -0,0 +1,65 @@
+#ifndef CHILD_REAPER_H
+#define CHILD_REAPER_H
+
+#include <sys/types.h>
+
+/**
+ * Kinds of child processes of the hive.
+ */
+#define CHILD_BEE 0
+#define CHILD_QUEEN 1
+#define CHILD_FORK_SERVER 2
+
+/**
+ * Entry of the table of child processes, bee_id is 0 for children that are
+ * not bees.
+ */
+typedef struct
+{
+    pid_t pid;
+    int kind;
+    int bee_id;
+    int pidfd;
+} child_process;
+
+/**
+ * Starts the thread that collects the child processes as soon as they exit.
+ * Each child is watched through its pidfd on an epoll loop, on kernels
+ * without pidfd_open a signalfd for SIGCHLD is used instead. The signalfd is
+ * kept with pidfds too, for the children whose pidfd could not be opened. SIGCHLD gets
+ * blocked in the calling thread, so this must be used before any other thread
+ * is started.
+ *
+ * @param on_exit - called on the reaper thread for every collected child with
+ *        its entry and its status as returned by waitpid
+ * @return int - 0 if the reaper was started, -1 otherwise
+ */
+int start_child_reaper(void (*on_exit)(child_process child, int status));
+
+/**
+ * Forks a child and adds it to the table before the reaper can see it exit.
+ * The child gets the signal mask it would have without the reaper. Nothing is
+ * forked if there is no memory to track the child.
+ *
+ * @param kind - one of the CHILD_ values
+ * @param bee_id - id of the bee the child runs, 0 if it is not a bee
+ * @return pid_t - as returned by fork, -1 with errno set to ENOMEM if there
+ *         was no memory to track the child
+ */
+pid_t fork_child(int kind, int bee_id);
+
+/**
+ * Waits until every child in the table has been collected or the timeout
+ * passed.
+ *
+ * @param timeout_ns - longest wait in ns
+ * @return int - 0 if every child was collected, -1 if some are left
+ */
+int wait_for_children(long long timeout_ns);
+
+/**
+ * Stops the reaper thread.
+ */
+void stop_child_reaper();
+
+#endif
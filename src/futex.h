@@ -0,0 +1,39 @@
+#ifndef FUTEX_H
+#define FUTEX_H
+
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <limits.h>
+#include <time.h>
+
+/**
+ * Blocks the caller as long as the 32-bit word at address still holds the
+ * expected value. The word may live in memory shared between processes.
+ *
+ * @param address Futex word.
+ * @param expected Value the word must hold for the caller to go to sleep.
+ * @param timeout Relative timeout or NULL to wait without a limit.
+ *
+ * @return 0 when woken up, -1 with errno set to EAGAIN, ETIMEDOUT or EINTR otherwise.
+ */
+static inline int futex_wait(void *address, uint32_t expected, const struct timespec *timeout)
+{
+    return syscall(SYS_futex, address, FUTEX_WAIT, expected, timeout, NULL, 0);
+}
+
+/**
+ * Wakes up to count processes or threads waiting on the futex word.
+ *
+ * @param address Futex word.
+ * @param count Maximum number of waiters to wake, INT_MAX wakes all of them.
+ *
+ * @return number of woken waiters or -1 on error.
+ */
+static inline int futex_wake(void *address, int count)
+{
+    return syscall(SYS_futex, address, FUTEX_WAKE, count, NULL, NULL, 0);
+}
+
+#endif
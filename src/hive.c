@@ -1,34 +1,30 @@
 #include <pthread.h>
-#include <semaphore.h>
 #include <sys/types.h>
 #include <sys/ipc.h>
 #include <sys/msg.h>
 #include <unistd.h>
 #include <stdlib.h>
-#include <dispatch/dispatch.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
 #include <sys/stat.h>
+#include <sys/wait.h>
 #include <errno.h>
+#include <getopt.h>
+#include <limits.h>
 
 #include "logger/logger.h"
 #include "hive_ipc.h"
+#include "bee_engine.h"
+#include "timer_wheel.h"
+#include "hive_simulation.h"
+#include "hive_time.h"
+#include "child_reaper.h"
+#include "hive_config.h"
+#include "queen_task.h"
 
 #define log_tag "HIVE"
 
-#define max(a, b) a > b ? a : b;
-
-/**
- * Represents the configuration of a bee.
- */
-typedef struct
-{
-    int id;
-    int time_in_hive;
-    int life_span;
-    int starts_in_hive;
-} bee_config;
-
 int child_pid_group = -1;
 
 #define handle_error(x)                                                                               \
@@ -39,8 +35,18 @@ int child_pid_group = -1;
     }
 
 volatile sig_atomic_t sigint = 0;
+volatile sig_atomic_t child_failed = 0;
 
 int max_bees_capacity;
+int transport = TRANSPORT_SHARED_MEMORY;
+int engine = ENGINE_PROCESS;
+long long virtual_time = 0;
+int clutch_size = 1;
+int queen_mode = QUEEN_PROCESS;
+config_limits limits = {
+    .max_number = DEFAULT_MAX_NUMBER,
+    .min_duration = DEFAULT_MIN_DURATION,
+    .max_duration = DEFAULT_MAX_DURATION};
 char *bees_config_filepath;
 char *logs_directory;
 int next_bee_id = 0;
@@ -49,115 +55,203 @@ void try_clean_and_exit_with_error();
 void try_clean_and_exit();
 void cleanup_resources();
 void initialize_gate_threads();
-void launch_bee_process(bee_config bee);
+void launch_bee(bee_config bee);
 
-pthread_mutex_t bees_inside_counter_mutex = PTHREAD_MUTEX_INITIALIZER;
-int bees_inside_counter = 0;
-
-pthread_t gate_threads[GATES_NUMBER];
-pthread_t zombie_collector_thread;
+pthread_t gate_threads[MAX_GATES];
+int gate_ids[MAX_GATES];
+int gate_thread_count = 0;
 pthread_t queen_thread;
+int queen_thread_started = 0;
 
 /**
- * @return int - 0 - success, 1 no child to wait for or error but received
- *         SIGINT earlier
+ * Records a child collected by the reaper. A child failing while the hive
+ * runs stops the hive with an error, as any other error does.
  */
-int wait_for_child()
+void child_exited(child_process child, int status)
 {
-    printf("Waiting for child\n");
-    int status = 0;
-    if (waitpid(-1, &status, 0) == -1)
+    const char *names[] = {"Bee", "Queen", "Fork server"};
+    if (WIFSIGNALED(status))
     {
-        if (errno == ECHILD)
-        {
-            return 1;
-        }
-        else
-        {
-            log(LOG_LEVEL_ERROR, log_tag, "ERROR %s at %s\n", strerror(errno), __func__);
-            if (!sigint)
-            {
-                try_clean_and_exit_with_error();
-            }
-            return 1;
-        }
+        log(LOG_LEVEL_INFO, log_tag, "%s %d (pid %d) killed by signal %d",
+            names[child.kind], child.bee_id, child.pid, WTERMSIG(status));
     }
     else
     {
-        if (!sigint && WEXITSTATUS(status) != 0)
-        {
-            try_clean_and_exit_with_error();
-        }
-        return 1;
+        log(LOG_LEVEL_INFO, log_tag, "%s %d (pid %d) exited with status %d",
+            names[child.kind], child.bee_id, child.pid, WEXITSTATUS(status));
     }
 
-    return 0;
+    if (!sigint && (WIFSIGNALED(status) || WEXITSTATUS(status) != 0))
+    {
+        child_failed = 1;
+        sigint = 1;
+    }
 }
 
 /**
- * Thread function for the zombie collector threads.
- * 
- * Waits for child processes to finish and collects them.
- * 
- * @param arg - not used
- * @return void* - NULL
+ * Thread function for the gate operations in shared memory transport.
+ *
+ * Lets the bees found in the gate control block through one by one, in the
+ * order of next_direction and in the order they asked within a direction.
  */
-void *zombie_collector_thread_function(void *arg)
+void *shared_gate_thread_function(void *arg)
 {
+    int gate_id = *((int *)arg);
+    gate_control_block *gate = &hive_shared->gates[gate_id];
+    gate_schedule schedule = {.direction = -1, .platoon = 0};
     while (!sigint)
     {
-        if (wait_for_child() == 1)
+        uint32_t requests = atomic_load(&gate->requests);
+        gate_slot *oldest[2] = {NULL, NULL};
+        int waiting[2] = {0, 0};
+        for (int i = 0; i < GATE_SLOTS; i++)
         {
-            sleep(1);
+            gate_slot *slot = &gate->slots[i];
+            if (atomic_load(&slot->state) != SLOT_REQUESTED)
+            {
+                continue;
+            }
+            int way = slot->delta == 1;
+            waiting[way]++;
+            if (oldest[way] == NULL || (int32_t)(slot->ticket - oldest[way]->ticket) < 0)
+            {
+                oldest[way] = slot;
+            }
         }
+
+        int direction = next_direction(&schedule, waiting[1], waiting[0]);
+        if (direction == 0)
+        {
+            wait_for_gate_requests(gate_id, requests);
+            continue;
+        }
+
+        gate_slot *slot = oldest[direction == 1];
+        if (!take_gate_request(slot))
+        {
+            // The bee withdrew its request.
+            continue;
+        }
+        atomic_fetch_add_explicit(&gate->bees_delta, direction, memory_order_relaxed);
+        pass_gate(gate_id, direction);
+        log(LOG_LEVEL_DEBUG, log_tag, "Gate %d: %d bees inside", gate_id, count_bees_inside());
+        grant_gate_request(slot);
     }
     return NULL;
 }
 
 /**
- * Thread function for the gate operations.
+ * Thread function for the gate operations in message queue transport.
+ *
+ * Once woken by a request it takes all the requests waiting in the queue and
+ * acknowledges them one by one in the order of next_direction, so only one
+ * bee crosses the gate at a time.
  */
 void *gate_thread_function(void *arg)
 {
     int gate_id = *((int *)arg);
-    free(arg);
+    int queue = hive_shared->gate_message_queue[gate_id];
+    gate_message messages[GATE_BATCH_SIZE];
+    gate_schedule schedule = {.direction = -1, .platoon = 0};
     while (!sigint)
     {
-        gate_message message;
-        handle_error(msgrcv(gate_message_queue[gate_id], &message, sizeof(int), USED_GATE_TYPE, 0));
-        log(LOG_LEVEL_DEBUG, log_tag, "Gate %d: Received message", gate_id);
-        pthread_mutex_lock(&bees_inside_counter_mutex);
-        bees_inside_counter += message.delta;
-        log(LOG_LEVEL_DEBUG, log_tag, "Gate %d: %d bees inside", gate_id, bees_inside_counter);
-        pthread_mutex_unlock(&bees_inside_counter_mutex);
-        message.type = ACK_TYPE;
-        log(LOG_LEVEL_DEBUG, log_tag, "Gate %d: Acknowledging", gate_id);
-        handle_error(msgsnd(gate_message_queue[gate_id], &message, sizeof(int), 0));
+        if (msgrcv(queue, &messages[0], GATE_MESSAGE_SIZE, USED_GATE_TYPE, 0) == -1)
+        {
+            // The queue is removed on purpose when the hive stops.
+            handle_error(-1);
+            continue;
+        }
+        int count = 1;
+        while (count < GATE_BATCH_SIZE &&
+               msgrcv(queue, &messages[count], GATE_MESSAGE_SIZE, USED_GATE_TYPE, IPC_NOWAIT) != -1)
+        {
+            count++;
+        }
+        if (count < GATE_BATCH_SIZE && errno != ENOMSG)
+        {
+            handle_error(-1);
+        }
+
+        int waiting[2] = {0, 0};
+        for (int i = 0; i < count; i++)
+        {
+            waiting[messages[i].delta == 1]++;
+        }
+        log(LOG_LEVEL_DEBUG, log_tag, "Gate %d: Received %d messages, %d entering, %d leaving", gate_id, count, waiting[1], waiting[0]);
+
+        // Messages of each direction are acknowledged in the order they arrived.
+        int next[2] = {0, 0};
+        for (int acknowledged = 0; acknowledged < count; acknowledged++)
+        {
+            int direction = next_direction(&schedule, waiting[1], waiting[0]);
+            int way = direction == 1;
+            while (messages[next[way]].delta != direction)
+            {
+                next[way]++;
+            }
+            gate_message *message = &messages[next[way]++];
+            waiting[way]--;
+
+            atomic_fetch_add_explicit(&hive_shared->gates[gate_id].bees_delta, direction, memory_order_relaxed);
+            pass_gate(gate_id, direction);
+            message->type = ACK_TYPE + message->pid;
+            handle_error(msgsnd(queue, message, GATE_MESSAGE_SIZE, 0));
+        }
+        log(LOG_LEVEL_DEBUG, log_tag, "Gate %d: %d bees inside", gate_id, count_bees_inside());
     }
     return NULL;
 }
 
 /**
- * Thread used for communication with the queen.
+ * @return configuration of a bee born from the queen, without its id
+ */
+bee_config hatch_bee()
+{
+    return (bee_config){
+        .time_in_hive = (rand() % 10 + 2) * NS_PER_SECOND,
+        .life_span = rand() % 10 + 2,
+        .starts_in_hive = 1};
+}
+
+/**
+ * Thread used for communication with the queen, through the queen message
+ * queue or straight from the queen task. Every message is a clutch of eggs
+ * with their room already reserved, the whole clutch hatches at once.
  */
 void *queen_thread_function(void *arg)
 {
+    (void)arg;
     while (!sigint)
     {
-        queen_message message;
-        log(LOG_LEVEL_INFO, log_tag, "Awaiting message from queen");
-        if (!sigint)
-            handle_error(msgrcv(queen_message_queue, &message, sizeof(int), GIVE_BIRTH, 0));
-        log(LOG_LEVEL_INFO, log_tag, "Recieved message from queen, creating new bee");
+        int eggs = 0;
+        if (queen_mode == QUEEN_TASK)
+        {
+            eggs = await_clutch();
+        }
+        else
+        {
+            queen_message message = {.type = GIVE_BIRTH, .data = 0};
+            log(LOG_LEVEL_INFO, log_tag, "Awaiting message from queen");
+            if (msgrcv(queen_message_queue, &message, sizeof(int), GIVE_BIRTH, 0) == -1)
+            {
+                // The queue is removed on purpose when the hive stops.
+                handle_error(-1);
+                continue;
+            }
+            eggs = message.data > 0 ? message.data : 1;
+        }
 
-        if (!sigint)
+        if (!sigint && eggs > 0)
         {
-            launch_bee_process(
-                (bee_config){
-                    .id = next_bee_id++,
-                    .time_in_hive = rand() % 10 + 2,
-                    .life_span = rand() % 10 + 2,
-                    .starts_in_hive = 1});
+            log(LOG_LEVEL_INFO, log_tag, "Recieved message from queen, creating %d new bees", eggs);
+            // The bees hatch inside without crossing a gate.
+            atomic_fetch_add_explicit(&hive_shared->gates[0].bees_delta, eggs, memory_order_relaxed);
+            for (int i = 0; i < eggs; i++)
+            {
+                bee_config bee = hatch_bee();
+                bee.id = next_bee_id++;
+                launch_bee(bee);
+            }
         }
     }
     return NULL;
@@ -172,218 +266,253 @@ void *queen_thread_function(void *arg)
  */
 void handle_sigint(int singal)
 {
+    (void)singal;
     sigint = 1;
 }
 
 /**
- * Initializes the zombie collector thread.
+ * Signals of the beekeeper. They are blocked in every thread of the hive and
+ * taken by the main loop with sigtimedwait, so they never interrupt a thread
+ * waiting in msgrcv. Children get them unblocked before exec.
  */
-void initialize_zombie_collector_thread()
-{
-    pthread_create(&zombie_collector_thread, NULL, zombie_collector_thread_function, NULL);
-}
+sigset_t frames_signals;
 
-/*
- * Initializes the gate threads.
- */
-void initialize_gate_threads()
+void block_frames_signals()
 {
-    for (int i = 0; i < GATES_NUMBER; i++)
-    {
-        int *gate_id = (int *)malloc(sizeof(int));
-        *gate_id = i;
-        pthread_create(&gate_threads[i], NULL, gate_thread_function, gate_id);
-    }
+    sigemptyset(&frames_signals);
+    sigaddset(&frames_signals, ADD_FRAMES_SIGNAL);
+    sigaddset(&frames_signals, REMOVE_FRAMES_SIGNAL);
+    pthread_sigmask(SIG_BLOCK, &frames_signals, NULL);
 }
 
-/**
- * Initializes the queen thread.
- */
-void initialize_queen_thread()
+void unblock_frames_signals()
 {
-    pthread_create(&queen_thread, NULL, queen_thread_function, NULL);
+    pthread_sigmask(SIG_UNBLOCK, &frames_signals, NULL);
 }
 
 /**
- * Parses the command line arguments. Expects the path to the bees config file.
+ * Waits up to a second for a signal of the beekeeper and adds or removes
+ * frames. The capacity changes at once with a single compare-and-swap, so
+ * gates keep going.
  */
-void parse_command_line_arguments(int argc, char *argv[])
+void serve_beekeeper()
 {
-    if (argc != 2)
+    const struct timespec timeout = {.tv_sec = 1, .tv_nsec = 0};
+    int signal = sigtimedwait(&frames_signals, NULL, &timeout);
+    if (signal == -1)
     {
-        fprintf(stderr, "Usage: %s <bees_config_file>\n", argv[0]);
-        exit(1);
+        return;
     }
-    bees_config_filepath = argv[1];
+    uint32_t capacity = scale_room_capacity(signal == ADD_FRAMES_SIGNAL, hive_shared->max_capacity);
+    log(LOG_LEVEL_INFO, log_tag, "Beekeeper set the capacity to %u, %u bees hold room",
+        capacity, OCCUPANCY_COUNT(read_occupancy()));
 }
 
-/**
- * Represents the configuration of the hive, including the bees and queen.
- * The format is described in read_config_file
+/*
+ * Initializes the gate threads.
  */
-typedef struct
+void initialize_gate_threads()
 {
-    int max_bees_capacity;
-    int number_of_bees;
-    int new_bee_interval;
-    bee_config *bees;
-} hive_config;
-
-#define REASONABLE_INPUT_MAX_NUMBER 100
-#define REASONABLE_INPUT_MIN_NUMBER 1
+    for (int i = 0; i < hive_shared->gate_count; i++)
+    {
+        gate_ids[i] = i;
+        if (pthread_create(&gate_threads[i], NULL,
+                           transport == TRANSPORT_SHARED_MEMORY ? shared_gate_thread_function : gate_thread_function,
+                           &gate_ids[i]) != 0)
+        {
+            handle_error(-1);
+        }
+        gate_thread_count++;
+    }
+}
 
 /**
- * Reads an integer from the file and stores it in the output parameter.
- *
- * @param file File to read from.
- * @param output Pointer to the integer where the read value will be stored.
- *
- * @return 1 if the integer was successfully read, 0 otherwise.
+ * Initializes the queen thread.
  */
-int read_integer(FILE *file, int *output)
+void initialize_queen_thread()
 {
-    char buffer[100];
-    if (fscanf(file, "%99s", buffer) != 1)
+    if (pthread_create(&queen_thread, NULL, queen_thread_function, NULL) != 0)
     {
-        return 0;
+        handle_error(-1);
     }
-
-    char *endptr;
-    errno = 0;
-    long value = strtol(buffer, &endptr, 10);
-
-    if (errno == ERANGE || value > REASONABLE_INPUT_MAX_NUMBER || value < REASONABLE_INPUT_MIN_NUMBER || *endptr != '\0')
-    {
-        return 0;
-    }
-
-    *output = (int)value;
-    return 1;
+    queen_thread_started = 1;
 }
 
 /**
- * Reads the configuration file and returns the hive configuration.
- *
- * The expected file format is:
- * <config>
- * N P
- * T
- * T_1 T_2 ... T_N
- * X_1 X_2 ... X_N
- * </config>
- *
- * Where:
- *  N is the number of bees
- *  P is the maximum number of bees in the hive
- *  T is the interval for new bees to be created by the queen
- *  T_i is the time that the i-th bee spends in the hive
- *  X_i is the life span of the i-th bee in terms of times it leaves the hive
- *
- * All the numbers should be in reasonable range.
- * Reasonable means in range [1 100]
+ * Wakes up the queen and gate threads and waits for them to finish, so that
+ * none of them launches a bee or touches the shared memory once the engine
+ * and the shared memory are gone. sigint must be set and the timer service
+ * stopped. A thread that is cleaning up itself is not waited for.
  */
-hive_config read_config_file()
+void stop_hive_threads()
 {
-    FILE *config_file = fopen(bees_config_filepath, "r");
-    if (!config_file)
+    stop_queen_task();
+    if (queen_mode == QUEEN_PROCESS)
     {
-        fprintf(stderr, "Error opening config file\n");
-        exit(1);
+        // msgrcv of the queen thread fails once the queue is removed.
+        close_queen_message_queue();
     }
-
-    int new_bee_interval, number_of_bees, max_bees_capacity;
-
-    if (!read_integer(config_file, &number_of_bees) || number_of_bees <= 0)
+    if (hive_shared != NULL)
     {
-        fprintf(stderr, "Invalid number of bees (N)\n");
-        fclose(config_file);
-        exit(1);
+        // Gate threads of the message queue transport fail msgrcv the same way.
+        wake_gate_threads();
+        close_gate_message_queues();
     }
 
-    if (!read_integer(config_file, &max_bees_capacity) || max_bees_capacity <= 0)
+    if (queen_thread_started && !pthread_equal(queen_thread, pthread_self()))
     {
-        fprintf(stderr, "Invalid maximum hive capacity (P)\n");
-        fclose(config_file);
-        exit(1);
+        pthread_join(queen_thread, NULL);
     }
-
-    if (!read_integer(config_file, &new_bee_interval) || new_bee_interval < 0)
-    {
-        fprintf(stderr, "Invalid new bee interval (T)\n");
-        fclose(config_file);
-        exit(1);
-    }
-
-    if (number_of_bees < 2 * max_bees_capacity)
+    queen_thread_started = 0;
+    for (int i = 0; i < gate_thread_count; i++)
     {
-        fprintf(stderr, "Invalid number of bees and maximum hive capacity\n");
-        fclose(config_file);
-        exit(1);
-    }
-
-    int *bee_time_in_hive = (int *)malloc(number_of_bees * sizeof(int));
-    int *bee_life_spans = (int *)malloc(number_of_bees * sizeof(int));
-
-    if (!bee_time_in_hive || !bee_life_spans)
-    {
-        fprintf(stderr, "Memory allocation failed\n");
-        fclose(config_file);
-        exit(1);
-    }
-
-    for (int i = 0; i < number_of_bees; i++)
-    {
-        if (!read_integer(config_file, &bee_time_in_hive[i]) || bee_time_in_hive[i] < 0)
+        if (!pthread_equal(gate_threads[i], pthread_self()))
         {
-            fprintf(stderr, "Invalid time in hive (T_%d)\n", i + 1);
-            free(bee_time_in_hive);
-            free(bee_life_spans);
-            fclose(config_file);
-            exit(1);
+            pthread_join(gate_threads[i], NULL);
         }
     }
+    gate_thread_count = 0;
+}
 
-    for (int i = 0; i < number_of_bees; i++)
+/**
+ * Parses the command line arguments. Expects the path to the bees config file.
+ *
+ * -t sets how bees ask for the gates: shm uses the gate control blocks in
+ *    shared memory (default), msg the message queues.
+ * -e sets how bees run: process launches every bee as ./bin/bee (default),
+ *    task runs them as tasks on worker threads inside the hive, pool hands
+ *    them to a fork server and reuses the processes of dead bees.
+ * -v, --virtual-time simulates the given time, in seconds unless it has a
+ *    unit, in virtual time instead of running the hive, see
+ *    run_hive_simulation.
+ * -n, --max-number lifts the limit of N, P and X_i in the config.
+ * -d, --max-duration lifts the limit of T and T_i in the config.
+ * -k, --clutch-size sets the most eggs the queen lays every T, 1 by default.
+ * -q, --queen sets where the queen runs: process launches ./bin/queen
+ *    (default), task runs her on the timer wheel of the hive, see
+ *    start_queen_task.
+ */
+void parse_command_line_arguments(int argc, char *argv[])
+{
+    static const struct option long_options[] = {
+        {"virtual-time", required_argument, NULL, 'v'},
+        {"max-number", required_argument, NULL, 'n'},
+        {"max-duration", required_argument, NULL, 'd'},
+        {"clutch-size", required_argument, NULL, 'k'},
+        {"queen", required_argument, NULL, 'q'},
+        {NULL, 0, NULL, 0}};
+    const char *usage = "Usage: %s [-t shm|msg] [-e process|task|pool] [-v|--virtual-time duration] [-n max_number] [-d max_duration] [-k clutch_size] [-q process|task] <bees_config_file>\n";
+    int option;
+    while ((option = getopt_long(argc, argv, "t:e:v:n:d:k:q:", long_options, NULL)) != -1)
     {
-        if (!read_integer(config_file, &bee_life_spans[i]) || bee_life_spans[i] < 0)
+        switch (option)
         {
-            fprintf(stderr, "Invalid life span (X_%d)\n", i + 1);
-            free(bee_time_in_hive);
-            free(bee_life_spans);
-            fclose(config_file);
+        case 't':
+            if (strcmp(optarg, "shm") == 0)
+            {
+                transport = TRANSPORT_SHARED_MEMORY;
+            }
+            else if (strcmp(optarg, "msg") == 0)
+            {
+                transport = TRANSPORT_MESSAGE_QUEUE;
+            }
+            else
+            {
+                fprintf(stderr, "Invalid transport %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'e':
+            if (strcmp(optarg, "process") == 0)
+            {
+                engine = ENGINE_PROCESS;
+            }
+            else if (strcmp(optarg, "task") == 0)
+            {
+                engine = ENGINE_TASK;
+            }
+            else if (strcmp(optarg, "pool") == 0)
+            {
+                engine = ENGINE_POOL;
+            }
+            else
+            {
+                fprintf(stderr, "Invalid engine %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'v':
+            if (parse_duration(optarg, &virtual_time) == -1 || virtual_time <= 0)
+            {
+                fprintf(stderr, "Invalid virtual time %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'n':
+            limits.max_number = atoll(optarg);
+            if (limits.max_number < 1 || limits.max_number > INT_MAX)
+            {
+                fprintf(stderr, "Invalid maximum number %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'd':
+            if (parse_duration(optarg, &limits.max_duration) == -1 || limits.max_duration < limits.min_duration)
+            {
+                fprintf(stderr, "Invalid maximum duration %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'k':
+            clutch_size = atoi(optarg);
+            if (clutch_size < 1)
+            {
+                fprintf(stderr, "Invalid clutch size %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'q':
+            if (strcmp(optarg, "process") == 0)
+            {
+                queen_mode = QUEEN_PROCESS;
+            }
+            else if (strcmp(optarg, "task") == 0)
+            {
+                queen_mode = QUEEN_TASK;
+            }
+            else
+            {
+                fprintf(stderr, "Invalid queen %s\n", optarg);
+                exit(1);
+            }
+            break;
+        default:
+            fprintf(stderr, usage, argv[0]);
             exit(1);
         }
     }
-
-    fclose(config_file);
-
-    hive_config config = {
-        .max_bees_capacity = max_bees_capacity,
-        .number_of_bees = number_of_bees,
-        .new_bee_interval = new_bee_interval,
-        .bees = (bee_config *)malloc(number_of_bees * sizeof(bee_config))};
-
-    if (!config.bees)
+    if (argc - optind != 1)
     {
-        fprintf(stderr, "Memory allocation failed for bees\n");
-        free(bee_time_in_hive);
-        free(bee_life_spans);
+        fprintf(stderr, usage, argv[0]);
         exit(1);
     }
+    bees_config_filepath = argv[optind];
+}
 
-    for (int i = 0; i < number_of_bees; i++)
+/**
+ * Loads the config file with the limits set on the command line, exits on
+ * an invalid config.
+ */
+hive_config read_config_file()
+{
+    hive_config config;
+    char error[128];
+    if (load_hive_config(bees_config_filepath, &limits, &config, error, sizeof(error)) == -1)
     {
-        config.bees[i].id = i;
-        config.bees[i].time_in_hive = bee_time_in_hive[i];
-        config.bees[i].life_span = bee_life_spans[i];
-        config.bees[i].starts_in_hive = 0;
-
-        next_bee_id = max(next_bee_id, i);
+        fprintf(stderr, "%s\n", error);
+        exit(1);
     }
-
-    free(bee_time_in_hive);
-    free(bee_life_spans);
-    next_bee_id++;
+    next_bee_id = config.number_of_bees;
     return config;
 }
 
@@ -393,11 +522,13 @@ hive_config read_config_file()
  */
 void launch_bee_process(bee_config bee)
 {
-    char *id;
-    char *life_span;
-    char *time_in_hive;
+    char id[12];
+    char life_span[12];
+    char time_in_hive[24];
+    char launched_at[24];
 
-    pid_t pid = fork();
+    snprintf(launched_at, sizeof(launched_at), "%lld", monotonic_now());
+    pid_t pid = fork_child(CHILD_BEE, bee.id + 1);
     switch (pid)
     {
     case -1:
@@ -405,13 +536,12 @@ void launch_bee_process(bee_config bee)
         try_clean_and_exit_with_error();
         break;
     case 0:
-        id = (char *)malloc(6);
-        sprintf(id, "%d", bee.id + 1);
-        life_span = (char *)malloc(6);
-        sprintf(life_span, "%d", bee.life_span);
-        time_in_hive = (char *)malloc(6);
-        sprintf(time_in_hive, "%d", bee.time_in_hive);
-        execl("./bin/bee", "./bin/bee", id, life_span, time_in_hive, time_in_hive, "0", NULL);
+        unblock_frames_signals();
+        snprintf(id, sizeof(id), "%d", bee.id + 1);
+        snprintf(life_span, sizeof(life_span), "%d", bee.life_span);
+        snprintf(time_in_hive, sizeof(time_in_hive), "%lldns", bee.time_in_hive);
+        // A bee born from the queen starts inside in the room reserved for its egg.
+        execl("./bin/bee", "./bin/bee", id, life_span, time_in_hive, time_in_hive, bee.starts_in_hive ? "1" : "0", launched_at, NULL);
         log(LOG_LEVEL_ERROR, "HIVE", "Error launching bee process, exiting...");
         try_clean_and_exit_with_error();
         break;
@@ -425,14 +555,82 @@ void launch_bee_process(bee_config bee)
     }
 }
 
+/**
+ * Hands the bee to an idle process of the pool, or to the fork server when
+ * no process is idle.
+ */
+void hand_bee_to_pool(bee_config bee)
+{
+    bee_assignment assignment = {
+        .type = claim_idle_bee() ? POOL_ASSIGN_TYPE : POOL_SPAWN_TYPE,
+        .id = bee.id + 1,
+        .life_span = bee.life_span,
+        .starts_in_hive = bee.starts_in_hive,
+        .time_in_hive = bee.time_in_hive,
+        .time_outside_hive = bee.time_in_hive,
+        .requested_at = monotonic_now()};
+    handle_error(msgsnd(hive_shared->pool_message_queue, &assignment, BEE_ASSIGNMENT_SIZE, 0));
+}
+
+/**
+ * Launches a bee in the chosen engine.
+ */
+void launch_bee(bee_config bee)
+{
+    if (engine == ENGINE_TASK)
+    {
+        if (spawn_bee_task(bee) == -1)
+        {
+            try_clean_and_exit_with_error();
+        }
+        return;
+    }
+    if (engine == ENGINE_POOL)
+    {
+        hand_bee_to_pool(bee);
+        return;
+    }
+    launch_bee_process(bee);
+}
+
+/**
+ * Launches the fork server of the bee pool and assigns it to the
+ * child_pid_group, the bees it forks stay in the group.
+ */
+void launch_fork_server()
+{
+    pid_t pid = fork_child(CHILD_FORK_SERVER, 0);
+    switch (pid)
+    {
+    case -1:
+        log(LOG_LEVEL_ERROR, log_tag, "Error launching fork server, exiting...");
+        try_clean_and_exit_with_error();
+        break;
+    case 0:
+        unblock_frames_signals();
+        execl("./bin/bee", "./bin/bee", "--pool", NULL);
+        log(LOG_LEVEL_ERROR, "HIVE", "Error launching fork server, exiting...");
+        try_clean_and_exit_with_error();
+        break;
+    default:
+        if (child_pid_group == -1)
+        {
+            child_pid_group = pid;
+        }
+        setpgid(pid, child_pid_group);
+        break;
+    }
+}
+
 /**
  * Launches the queen process and assigns it to the child_pid_group that is later
  * used to propagate the SIGINT signal to all child processes.
  */
-void launch_queen_process(int new_bee_interval)
+void launch_queen_process(long long new_bee_interval)
 {
-    char *interval;
-    pid_t pid = fork();
+    char interval[24];
+    char clutch[12];
+    pid_t pid = fork_child(CHILD_QUEEN, 0);
     switch (pid)
     {
     case -1:
@@ -440,9 +638,10 @@ void launch_queen_process(int new_bee_interval)
         try_clean_and_exit_with_error();
         break;
     case 0:
-        interval = (char *)malloc(10);
-        sprintf(interval, "%d", new_bee_interval);
-        execl("./bin/queen", "./bin/queen", interval, NULL);
+        unblock_frames_signals();
+        snprintf(interval, sizeof(interval), "%lldns", new_bee_interval);
+        snprintf(clutch, sizeof(clutch), "%d", clutch_size);
+        execl("./bin/queen", "./bin/queen", interval, clutch, NULL);
         log(LOG_LEVEL_ERROR, "HIVE", "Error launching queen process, exiting...");
         try_clean_and_exit_with_error();
         break;
@@ -465,27 +664,104 @@ void launch_bee_processes(hive_config config)
 {
     for (int i = 0; i < config.number_of_bees; i++)
     {
-        launch_bee_process(config.bees[i]);
+        launch_bee(config.bees[i]);
+    }
+}
+
+#define STARTUP_REPORT_TIMEOUT_NS (10 * NS_PER_SECOND)
+
+/**
+ * Waits until all the bees of the config started and reports how long it
+ * took since launching began.
+ *
+ * @param launch_started_at - when the hive started launching, in ns of CLOCK_MONOTONIC
+ * @param number_of_bees - number of bees of the config
+ */
+void report_startup(long long launch_started_at, int number_of_bees)
+{
+    launch_statistics *statistics = &hive_shared->launches[LAUNCH_INITIAL];
+    long long deadline = launch_started_at + STARTUP_REPORT_TIMEOUT_NS;
+    while (!sigint && atomic_load(&statistics->started) < (uint64_t)number_of_bees && monotonic_now() < deadline)
+    {
+        sleep_until(monotonic_now() + 10 * NS_PER_MILLISECOND);
+    }
+
+    uint64_t started = atomic_load(&statistics->started);
+    if (started == 0)
+    {
+        return;
+    }
+    long long startup = atomic_load(&statistics->last_started_at) - launch_started_at;
+    long long average = atomic_load(&statistics->total_latency) / started;
+    printf("Started %llu/%d bees in %.3f ms, %.3f ms on average, at most %.3f ms\n",
+           (unsigned long long)started, number_of_bees, startup / 1e6, average / 1e6,
+           atomic_load(&statistics->max_latency) / 1e6);
+    log(LOG_LEVEL_INFO, log_tag, "Started %llu/%d bees in %lld us, latency average %lld us, max %llu us",
+        (unsigned long long)started, number_of_bees, startup / NS_PER_MICROSECOND, average / NS_PER_MICROSECOND,
+        (unsigned long long)(atomic_load(&statistics->max_latency) / NS_PER_MICROSECOND));
+}
+
+/**
+ * Reports how long the bees born from the queen took to start.
+ */
+void report_birth_latency()
+{
+    if (hive_shared == NULL)
+    {
+        return;
     }
+    launch_statistics *statistics = &hive_shared->launches[LAUNCH_BIRTH];
+    uint64_t started = atomic_load(&statistics->started);
+    if (started == 0)
+    {
+        return;
+    }
+    long long average = atomic_load(&statistics->total_latency) / started;
+    printf("Births: %llu, latency %.3f ms on average, at most %.3f ms\n",
+           (unsigned long long)started, average / 1e6, atomic_load(&statistics->max_latency) / 1e6);
+    log(LOG_LEVEL_INFO, log_tag, "Births: %llu, latency average %lld us, max %llu us",
+        (unsigned long long)started, average / NS_PER_MICROSECOND,
+        (unsigned long long)(atomic_load(&statistics->max_latency) / NS_PER_MICROSECOND));
 }
 
+/**
+ * Longest the hive waits for its children to exit after SIGINT, and again
+ * after SIGKILL.
+ */
+#define CHILDREN_EXIT_TIMEOUT_NS (5 * NS_PER_SECOND)
+
 /**
  * Propagates the SIGINT signal to all child processes.
- * Waits for the child processes to finish.
+ * Waits for the child processes to finish, kills them if they do not.
  * Cleans up the resources and exits the program.
  */
 void cleanup_resources()
 {
     printf("cleanup resources called\n");
-    kill(-child_pid_group, SIGINT);
+    // With bees run as tasks and the queen as a task there are no children.
+    if (child_pid_group > 0)
+    {
+        kill(-child_pid_group, SIGINT);
+    }
     sigint = 1;
-    while (wait_for_child() == 0)
-        ;
-
-    close_gate_message_queue();
-    close_queen_message_queue();
-    close_semaphores();
-    unlink_semaphores();
+    if (wait_for_children(CHILDREN_EXIT_TIMEOUT_NS) == -1)
+    {
+        log(LOG_LEVEL_ERROR, log_tag, "Children did not exit after SIGINT, killing them");
+        if (child_pid_group > 0)
+        {
+            kill(-child_pid_group, SIGKILL);
+        }
+        wait_for_children(CHILDREN_EXIT_TIMEOUT_NS);
+    }
+    stop_child_reaper();
+
+    report_birth_latency();
+    stop_timer_service();
+    stop_hive_threads();
+    stop_bee_engine();
+    close_pool_message_queue();
+    close_shared_memory();
+    unlink_shared_memory();
     close_logger();
 }
 
@@ -507,6 +783,34 @@ void try_clean_and_exit()
     exit(0);
 }
 
+/**
+ * Runs the configured hive in virtual time and prints the totals.
+ */
+void simulate_hive(hive_config config)
+{
+    simulation_report report;
+    if (run_hive_simulation(config.max_bees_capacity, config.new_bee_interval, clutch_size, config.gates_number,
+                            config.bees, config.number_of_bees, hatch_bee, virtual_time, &report) == -1)
+    {
+        fprintf(stderr, "Memory allocation failed for the simulation\n");
+        free(config.bees);
+        close_logger();
+        exit(1);
+    }
+
+    printf("Simulated %.3f s in %.3f s of real time, %lld events\n",
+           (double)virtual_time / NS_PER_SECOND, report.wall_seconds, report.events);
+    printf("Entries %lld, exits %lld, births %lld, deaths %lld\n", report.entries, report.exits, report.births, report.deaths);
+    printf("Occupancy max %d/%d, mean %.2f, at most %d waiting for room\n",
+           report.max_occupancy, config.max_bees_capacity, report.mean_occupancy, report.max_waiting_for_room);
+    for (int i = 0; i < config.gates_number; i++)
+    {
+        printf("Gate %d: %lld crossings\n", i, report.gate_crossings[i]);
+    }
+    log(LOG_LEVEL_INFO, log_tag, "Simulated %lldns in %.3f s, max occupancy %d/%d",
+        virtual_time, report.wall_seconds, report.max_occupancy, config.max_bees_capacity);
+}
+
 int main(int argc, char *argv[])
 {
     signal(SIGINT, handle_sigint);
@@ -514,20 +818,65 @@ int main(int argc, char *argv[])
     log(LOG_LEVEL_INFO, "HIVE", "Starting hive");
     parse_command_line_arguments(argc, argv);
     hive_config config = read_config_file();
-    handle_error(initialize_gate_message_queue());
-    handle_error(initialize_queen_message_queue());
-    handle_error(open_semaphores(config.max_bees_capacity));
+    if (virtual_time > 0)
+    {
+        simulate_hive(config);
+        free(config.bees);
+        close_logger();
+        return 0;
+    }
+    // Before any thread starts, they must all block SIGCHLD and the beekeeper signals.
+    block_frames_signals();
+    handle_error(start_child_reaper(child_exited));
+    if (queen_mode == QUEEN_PROCESS)
+    {
+        handle_error(initialize_queen_message_queue());
+    }
+    handle_error(open_shared_memory(1));
+    hive_shared->transport = transport;
+    set_room_capacity(config.max_bees_capacity);
+    hive_shared->max_capacity = 2 * config.number_of_bees;
+    handle_error(initialize_gate_message_queues(config.gates_number));
+    handle_error(start_timer_service());
+    if (engine == ENGINE_TASK)
+    {
+        handle_error(start_bee_engine(0));
+    }
+    if (engine == ENGINE_POOL)
+    {
+        handle_error(initialize_pool_message_queue());
+        launch_fork_server();
+    }
+    long long launch_started_at = monotonic_now();
     launch_bee_processes(config);
-    launch_queen_process(config.new_bee_interval);
+    if (queen_mode == QUEEN_TASK)
+    {
+        start_queen_task(config.new_bee_interval, clutch_size);
+    }
+    else
+    {
+        launch_queen_process(config.new_bee_interval);
+    }
 
     initialize_queen_thread();
-    initialize_zombie_collector_thread();
-    initialize_gate_threads();
+    if (engine != ENGINE_TASK)
+    {
+        initialize_gate_threads();
+    }
+
+    if (engine != ENGINE_TASK)
+    {
+        report_startup(launch_started_at, config.number_of_bees);
+    }
 
     while (!sigint)
     {
-        sleep(1);
+        serve_beekeeper();
     }
 
+    if (child_failed)
+    {
+        try_clean_and_exit_with_error();
+    }
     try_clean_and_exit();
 }
@@ -0,0 +1,344 @@
+#include "hive_config.h"
+#include "hive_ipc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/**
+ * Position in the mapped text of the config.
+ */
+typedef struct
+{
+    const char *next;
+    const char *end;
+} config_cursor;
+
+static int is_space(char c)
+{
+    return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+/**
+ * Finds the next whitespace separated token.
+ *
+ * @return length of the token, 0 at the end of the text
+ */
+static size_t next_token(config_cursor *cursor, const char **token)
+{
+    const char *next = cursor->next;
+    while (next < cursor->end && is_space(*next))
+    {
+        next++;
+    }
+    *token = next;
+    while (next < cursor->end && !is_space(*next))
+    {
+        next++;
+    }
+    cursor->next = next;
+    return next - *token;
+}
+
+/**
+ * Reads a whole number in the range [1 max].
+ *
+ * @return 1 if the number was successfully read, 0 otherwise
+ */
+static int read_number(config_cursor *cursor, long long max, long long *output)
+{
+    const char *token;
+    size_t length = next_token(cursor, &token);
+    if (length == 0)
+    {
+        return 0;
+    }
+
+    long long value = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (token[i] < '0' || token[i] > '9' || value > (max - (token[i] - '0')) / 10)
+        {
+            return 0;
+        }
+        value = value * 10 + (token[i] - '0');
+    }
+    if (value < 1)
+    {
+        return 0;
+    }
+    *output = value;
+    return 1;
+}
+
+/**
+ * Reads a duration in the range of the limits, see parse_duration for the format.
+ *
+ * @return 1 if the duration was successfully read, 0 otherwise
+ */
+static int read_duration(config_cursor *cursor, const config_limits *limits, long long *output)
+{
+    const char *token;
+    size_t length = next_token(cursor, &token);
+    long long value;
+    if (length == 0 || parse_duration_length(token, length, &value) == -1 ||
+        value < limits->min_duration || value > limits->max_duration)
+    {
+        return 0;
+    }
+    *output = value;
+    return 1;
+}
+
+static int invalid(char *error, size_t error_size, const char *message)
+{
+    snprintf(error, error_size, "%s", message);
+    return -1;
+}
+
+/**
+ * Checks the values shared by both formats.
+ */
+static int check_totals(const hive_config *config, const config_limits *limits, char *error, size_t error_size)
+{
+    if (config->number_of_bees < 1 || config->number_of_bees > limits->max_number)
+    {
+        return invalid(error, error_size, "Invalid number of bees (N)");
+    }
+    if (config->max_bees_capacity < 1 || config->max_bees_capacity > limits->max_number)
+    {
+        return invalid(error, error_size, "Invalid maximum hive capacity (P)");
+    }
+    if (config->new_bee_interval < limits->min_duration || config->new_bee_interval > limits->max_duration)
+    {
+        return invalid(error, error_size, "Invalid new bee interval (T)");
+    }
+    if (config->number_of_bees < 2LL * config->max_bees_capacity)
+    {
+        return invalid(error, error_size, "Invalid number of bees and maximum hive capacity");
+    }
+    return 0;
+}
+
+static int allocate_bees(hive_config *config, char *error, size_t error_size)
+{
+    config->bees = malloc(config->number_of_bees * sizeof(bee_config));
+    if (config->bees == NULL)
+    {
+        return invalid(error, error_size, "Memory allocation failed for bees");
+    }
+    return 0;
+}
+
+static int parse_text_config(config_cursor *cursor, const config_limits *limits, hive_config *config,
+                             char *error, size_t error_size)
+{
+    long long number_of_bees, max_bees_capacity;
+    if (!read_number(cursor, limits->max_number, &number_of_bees))
+    {
+        return invalid(error, error_size, "Invalid number of bees (N)");
+    }
+    if (!read_number(cursor, limits->max_number, &max_bees_capacity))
+    {
+        return invalid(error, error_size, "Invalid maximum hive capacity (P)");
+    }
+    config->number_of_bees = number_of_bees;
+    config->max_bees_capacity = max_bees_capacity;
+    if (!read_duration(cursor, limits, &config->new_bee_interval))
+    {
+        return invalid(error, error_size, "Invalid new bee interval (T)");
+    }
+    if (check_totals(config, limits, error, error_size) == -1 || allocate_bees(config, error, error_size) == -1)
+    {
+        return -1;
+    }
+
+    for (int i = 0; i < config->number_of_bees; i++)
+    {
+        if (!read_duration(cursor, limits, &config->bees[i].time_in_hive))
+        {
+            snprintf(error, error_size, "Invalid time in hive (T_%d)", i + 1);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < config->number_of_bees; i++)
+    {
+        long long life_span;
+        if (!read_number(cursor, limits->max_number, &life_span))
+        {
+            snprintf(error, error_size, "Invalid life span (X_%d)", i + 1);
+            return -1;
+        }
+        config->bees[i].life_span = life_span;
+    }
+
+    config->gates_number = DEFAULT_GATES_NUMBER;
+    const char *token;
+    config_cursor gates = *cursor;
+    if (next_token(&gates, &token) > 0)
+    {
+        long long gates_number;
+        if (!read_number(cursor, MAX_GATES, &gates_number))
+        {
+            snprintf(error, error_size, "Invalid number of gates (G), at most %d gates are supported", MAX_GATES);
+            return -1;
+        }
+        config->gates_number = gates_number;
+        if (next_token(cursor, &token) > 0)
+        {
+            return invalid(error, error_size, "Unexpected data after the number of gates (G)");
+        }
+    }
+    return 0;
+}
+
+static int parse_binary_config(const char *data, size_t size, const config_limits *limits, hive_config *config,
+                               char *error, size_t error_size)
+{
+    binary_config_header header;
+    memcpy(&header, data, sizeof(header));
+    // Out of range counts are turned into 0, which check_totals rejects.
+    config->number_of_bees = header.number_of_bees > limits->max_number ? 0 : header.number_of_bees;
+    config->max_bees_capacity = header.max_bees_capacity > limits->max_number ? 0 : header.max_bees_capacity;
+    config->new_bee_interval = header.new_bee_interval;
+    if (check_totals(config, limits, error, error_size) == -1)
+    {
+        return -1;
+    }
+    if (size != sizeof(header) + (size_t)config->number_of_bees * (sizeof(int64_t) + sizeof(uint32_t)))
+    {
+        return invalid(error, error_size, "Invalid size of the binary config");
+    }
+    if (header.gates_number < 1 || header.gates_number > MAX_GATES)
+    {
+        snprintf(error, error_size, "Invalid number of gates (G), at most %d gates are supported", MAX_GATES);
+        return -1;
+    }
+    config->gates_number = header.gates_number;
+    if (allocate_bees(config, error, error_size) == -1)
+    {
+        return -1;
+    }
+
+    const char *times = data + sizeof(header);
+    const char *life_spans = times + config->number_of_bees * sizeof(int64_t);
+    for (int i = 0; i < config->number_of_bees; i++)
+    {
+        int64_t time_in_hive;
+        memcpy(&time_in_hive, times + i * sizeof(int64_t), sizeof(time_in_hive));
+        if (time_in_hive < limits->min_duration || time_in_hive > limits->max_duration)
+        {
+            snprintf(error, error_size, "Invalid time in hive (T_%d)", i + 1);
+            return -1;
+        }
+        config->bees[i].time_in_hive = time_in_hive;
+    }
+    for (int i = 0; i < config->number_of_bees; i++)
+    {
+        uint32_t life_span;
+        memcpy(&life_span, life_spans + i * sizeof(uint32_t), sizeof(life_span));
+        if (life_span < 1 || life_span > limits->max_number)
+        {
+            snprintf(error, error_size, "Invalid life span (X_%d)", i + 1);
+            return -1;
+        }
+        config->bees[i].life_span = life_span;
+    }
+    return 0;
+}
+
+int load_hive_config(const char *path, const config_limits *limits, hive_config *config,
+                     char *error, size_t error_size)
+{
+    memset(config, 0, sizeof(*config));
+    int fd = open(path, O_RDONLY);
+    struct stat status;
+    if (fd == -1 || fstat(fd, &status) == -1)
+    {
+        if (fd != -1)
+        {
+            close(fd);
+        }
+        return invalid(error, error_size, "Error opening config file");
+    }
+
+    size_t size = status.st_size;
+    const char *data = NULL;
+    if (size > 0)
+    {
+        data = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    }
+    close(fd);
+    if (data == MAP_FAILED)
+    {
+        return invalid(error, error_size, "Error opening config file");
+    }
+
+    int result;
+    if (size >= sizeof(binary_config_header) && memcmp(data, BINARY_CONFIG_MAGIC, 8) == 0)
+    {
+        result = parse_binary_config(data, size, limits, config, error, error_size);
+    }
+    else
+    {
+        madvise((void *)data, size, MADV_SEQUENTIAL);
+        config_cursor cursor = {.next = data, .end = data + size};
+        result = parse_text_config(&cursor, limits, config, error, error_size);
+    }
+    if (size > 0)
+    {
+        munmap((void *)data, size);
+    }
+
+    if (result == -1)
+    {
+        free(config->bees);
+        config->bees = NULL;
+        return -1;
+    }
+    for (int i = 0; i < config->number_of_bees; i++)
+    {
+        config->bees[i].id = i;
+        config->bees[i].starts_in_hive = 0;
+    }
+    return 0;
+}
+
+int save_binary_config(const char *path, const hive_config *config)
+{
+    FILE *file = fopen(path, "wb");
+    if (file == NULL)
+    {
+        return -1;
+    }
+
+    binary_config_header header = {
+        .number_of_bees = config->number_of_bees,
+        .max_bees_capacity = config->max_bees_capacity,
+        .gates_number = config->gates_number,
+        .reserved = 0,
+        .new_bee_interval = config->new_bee_interval};
+    memcpy(header.magic, BINARY_CONFIG_MAGIC, sizeof(header.magic));
+    int ok = fwrite(&header, sizeof(header), 1, file) == 1;
+    for (int i = 0; ok && i < config->number_of_bees; i++)
+    {
+        int64_t time_in_hive = config->bees[i].time_in_hive;
+        ok = fwrite(&time_in_hive, sizeof(time_in_hive), 1, file) == 1;
+    }
+    for (int i = 0; ok && i < config->number_of_bees; i++)
+    {
+        uint32_t life_span = config->bees[i].life_span;
+        ok = fwrite(&life_span, sizeof(life_span), 1, file) == 1;
+    }
+    if (fclose(file) != 0 || !ok)
+    {
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+#ifndef HIVE_CONFIG_H
+#define HIVE_CONFIG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "bee_engine.h"
+#include "hive_time.h"
+
+/**
+ * Represents the configuration of the hive, including the bees and queen.
+ * The format is described in load_hive_config.
+ */
+typedef struct
+{
+    int max_bees_capacity;
+    int number_of_bees;
+    long long new_bee_interval;                     /* in ns */
+    int gates_number;
+    bee_config *bees;
+} hive_config;
+
+/**
+ * Ranges a config must fit in. N, P and X_i are checked against
+ * [1 max_number], T and T_i against [min_duration max_duration].
+ */
+typedef struct
+{
+    long long max_number;
+    long long min_duration;                         /* in ns */
+    long long max_duration;                         /* in ns */
+} config_limits;
+
+#define DEFAULT_MAX_NUMBER 100
+#define DEFAULT_MIN_DURATION NS_PER_MICROSECOND
+#define DEFAULT_MAX_DURATION (100 * NS_PER_SECOND)
+
+/**
+ * Header of the binary config, followed by N times in hive as int64_t ns and
+ * N life spans as uint32_t, all in the byte order of the machine.
+ */
+#define BINARY_CONFIG_MAGIC "HIVECFG1"
+
+typedef struct
+{
+    char magic[8];
+    uint32_t number_of_bees;
+    uint32_t max_bees_capacity;
+    uint32_t gates_number;
+    uint32_t reserved;
+    int64_t new_bee_interval;
+} binary_config_header;
+
+/**
+ * Loads the config from the file, text or binary, which is told by the magic
+ * at the start. The file is memory mapped and parsed in place.
+ *
+ * The expected text format is:
+ * <config>
+ * N P
+ * T
+ * T_1 T_2 ... T_N
+ * X_1 X_2 ... X_N
+ * G
+ * </config>
+ *
+ * Where:
+ *  N is the number of bees
+ *  P is the maximum number of bees in the hive
+ *  T is the interval for new bees to be created by the queen
+ *  T_i is the time that the i-th bee spends in the hive
+ *  X_i is the life span of the i-th bee in terms of times it leaves the hive
+ *  G is the number of gates, optional, DEFAULT_GATES_NUMBER if missing,
+ *    nothing may follow it
+ *
+ * All the numbers should be in the ranges of the limits, N at least 2P and G
+ * at most MAX_GATES. T and T_i may have a unit: s, ms, us or ns, seconds if
+ * there is none.
+ *
+ * @param path - path of the config file
+ * @param limits - ranges the values must fit in
+ * @param config - filled with the config, its bees are allocated with malloc
+ * @param error - filled with the reason when the config is invalid, naming
+ *        the offending value and its index
+ * @param error_size - size of the error buffer
+ * @return int - 0 if the config was loaded, -1 otherwise
+ */
+int load_hive_config(const char *path, const config_limits *limits, hive_config *config,
+                     char *error, size_t error_size);
+
+/**
+ * Writes the config in the binary format.
+ *
+ * @return int - 0 if the config was written, -1 otherwise with errno set
+ */
+int save_binary_config(const char *path, const hive_config *config);
+
+#endif
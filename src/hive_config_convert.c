@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+
+#include "hive_config.h"
+
+/**
+ * Converts a text config of the hive to the binary format, which the hive
+ * loads without parsing. Takes the same limits as the hive.
+ */
+int main(int argc, char *argv[])
+{
+    const char *usage = "Usage: %s [-n max_number] [-d max_duration] <text_config> <binary_config>\n";
+    config_limits limits = {
+        .max_number = DEFAULT_MAX_NUMBER,
+        .min_duration = DEFAULT_MIN_DURATION,
+        .max_duration = DEFAULT_MAX_DURATION};
+    int option;
+    while ((option = getopt(argc, argv, "n:d:")) != -1)
+    {
+        switch (option)
+        {
+        case 'n':
+            limits.max_number = atoll(optarg);
+            if (limits.max_number < 1 || limits.max_number > INT_MAX)
+            {
+                fprintf(stderr, "Invalid maximum number %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'd':
+            if (parse_duration(optarg, &limits.max_duration) == -1 || limits.max_duration < limits.min_duration)
+            {
+                fprintf(stderr, "Invalid maximum duration %s\n", optarg);
+                return 1;
+            }
+            break;
+        default:
+            fprintf(stderr, usage, argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2)
+    {
+        fprintf(stderr, usage, argv[0]);
+        return 1;
+    }
+
+    hive_config config;
+    char error[128];
+    if (load_hive_config(argv[optind], &limits, &config, error, sizeof(error)) == -1)
+    {
+        fprintf(stderr, "%s\n", error);
+        return 1;
+    }
+    if (save_binary_config(argv[optind + 1], &config) == -1)
+    {
+        fprintf(stderr, "Error writing %s: %s\n", argv[optind + 1], strerror(errno));
+        free(config.bees);
+        return 1;
+    }
+    printf("Converted %d bees\n", config.number_of_bees);
+    free(config.bees);
+    return 0;
+}
@@ -0,0 +1,476 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "hive_config.h"
+#include "hive_ipc.h"
+
+#define DISTRIBUTION_CONSTANT 0
+#define DISTRIBUTION_UNIFORM 1
+#define DISTRIBUTION_EXPONENTIAL 2
+#define DISTRIBUTION_BIMODAL 3
+
+#define DEFAULT_NUMBER_OF_BEES 20
+#define DEFAULT_RATIO 2.0
+
+/**
+ * Distribution of T_i or X_i, values are ns for T_i. A bimodal distribution
+ * gives first with the probability weight and second otherwise.
+ */
+typedef struct
+{
+    int kind;
+    long long first;
+    long long second;
+    double weight;
+} distribution;
+
+/**
+ * State of the splitmix64 generator, the same seed gives the same config on
+ * every machine.
+ */
+static uint64_t random_state;
+
+static uint64_t next_random()
+{
+    uint64_t z = (random_state += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/**
+ * @return double - uniform in [0 1)
+ */
+static double next_unit()
+{
+    return (next_random() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+/**
+ * Draws a value, values never go below 0 as parsed values are not negative,
+ * callers clamp them to the limits.
+ */
+static long long sample(const distribution *d)
+{
+    switch (d->kind)
+    {
+    case DISTRIBUTION_UNIFORM:
+        // Both ends are at least 0, so the width fits in uint64_t even for the widest range.
+        return d->first + (long long)(next_random() % ((uint64_t)(d->second - d->first) + 1));
+    case DISTRIBUTION_EXPONENTIAL:
+    {
+        // Clamped while still a double, converting an out of range double is undefined.
+        double value = -log(1.0 - next_unit()) * d->first;
+        return value >= (double)LLONG_MAX ? LLONG_MAX : llround(value);
+    }
+    case DISTRIBUTION_BIMODAL:
+        return next_unit() < d->weight ? d->first : d->second;
+    default:
+        return d->first;
+    }
+}
+
+static long long clamp(long long value, long long min, long long max)
+{
+    return value < min ? min : value > max ? max : value;
+}
+
+/**
+ * Parses one value of a distribution, a duration or a whole number.
+ */
+static int parse_value(const char *text, size_t length, int is_duration, long long *value)
+{
+    if (is_duration)
+    {
+        return parse_duration_length(text, length, value);
+    }
+    long long number = 0;
+    for (size_t i = 0; i < length; i++)
+    {
+        if (text[i] < '0' || text[i] > '9' || number > (LLONG_MAX - (text[i] - '0')) / 10)
+        {
+            return -1;
+        }
+        number = number * 10 + (text[i] - '0');
+    }
+    *value = number;
+    return length > 0 ? 0 : -1;
+}
+
+/**
+ * Parses a distribution: constant:V, uniform:MIN:MAX, exponential:MEAN or
+ * bimodal:A:B:WEIGHT.
+ *
+ * @return int - 0 if the distribution is valid, -1 otherwise
+ */
+static int parse_distribution(const char *text, int is_duration, distribution *d)
+{
+    const char *names[] = {"constant", "uniform", "exponential", "bimodal"};
+    const int value_counts[] = {1, 2, 1, 2};
+    const char *colon = strchr(text, ':');
+    if (colon == NULL)
+    {
+        return -1;
+    }
+
+    d->kind = -1;
+    for (int i = 0; i < 4; i++)
+    {
+        if (strlen(names[i]) == (size_t)(colon - text) && strncmp(text, names[i], colon - text) == 0)
+        {
+            d->kind = i;
+        }
+    }
+    if (d->kind == -1)
+    {
+        return -1;
+    }
+
+    long long values[2] = {0, 0};
+    const char *next = colon + 1;
+    for (int i = 0; i < value_counts[d->kind]; i++)
+    {
+        const char *end = strchr(next, ':');
+        size_t length = end ? (size_t)(end - next) : strlen(next);
+        if (parse_value(next, length, is_duration, &values[i]) == -1)
+        {
+            return -1;
+        }
+        next = end ? end + 1 : next + length;
+    }
+
+    d->first = values[0];
+    d->second = values[1];
+    d->weight = 0.5;
+    if (d->kind == DISTRIBUTION_BIMODAL && *next != '\0')
+    {
+        char *end;
+        d->weight = strtod(next, &end);
+        if (*end != '\0' || d->weight < 0 || d->weight > 1)
+        {
+            return -1;
+        }
+    }
+    else if (*next != '\0')
+    {
+        return -1;
+    }
+    if (d->kind == DISTRIBUTION_UNIFORM && d->second < d->first)
+    {
+        return -1;
+    }
+    return 0;
+}
+
+/**
+ * Prints the duration in the largest unit that keeps it exact.
+ */
+static void print_duration(FILE *file, long long duration)
+{
+    if (duration % NS_PER_SECOND == 0)
+    {
+        fprintf(file, "%lld", duration / NS_PER_SECOND);
+    }
+    else if (duration % NS_PER_MILLISECOND == 0)
+    {
+        fprintf(file, "%lldms", duration / NS_PER_MILLISECOND);
+    }
+    else if (duration % NS_PER_MICROSECOND == 0)
+    {
+        fprintf(file, "%lldus", duration / NS_PER_MICROSECOND);
+    }
+    else
+    {
+        fprintf(file, "%lldns", duration);
+    }
+}
+
+static int write_text_config(FILE *file, const hive_config *config)
+{
+    fprintf(file, "%d %d\n", config->number_of_bees, config->max_bees_capacity);
+    print_duration(file, config->new_bee_interval);
+    fputc('\n', file);
+    for (int i = 0; i < config->number_of_bees; i++)
+    {
+        print_duration(file, config->bees[i].time_in_hive);
+        fputc(i + 1 < config->number_of_bees ? ' ' : '\n', file);
+    }
+    for (int i = 0; i < config->number_of_bees; i++)
+    {
+        fprintf(file, "%d%c", config->bees[i].life_span, i + 1 < config->number_of_bees ? ' ' : '\n');
+    }
+    fprintf(file, "%d\n", config->gates_number);
+    return ferror(file) ? -1 : 0;
+}
+
+static void usage(const char *program)
+{
+    fprintf(stderr,
+            "Usage: %s [-N bees] [-P capacity | -r ratio] [-T interval] [-t distribution] [-x distribution]\n"
+            "       [-g gates] [-s seed] [-n max_number] [-d max_duration] [-b] [-o output]\n"
+            "Distributions: constant:V, uniform:MIN:MAX, exponential:MEAN, bimodal:A:B[:WEIGHT]\n",
+            program);
+    exit(1);
+}
+
+static void invalid_option(const char *program, const char *name, const char *text)
+{
+    fprintf(stderr, "Invalid %s %s\n", name, text);
+    usage(program);
+}
+
+/**
+ * Parses a whole number option. Signs and spaces are not accepted, so a
+ * negative value is never wrapped around.
+ *
+ * @return int - 0 if the whole text is a number that fits, -1 otherwise
+ */
+static int parse_number(const char *text, long long *value)
+{
+    if (*text < '0' || *text > '9')
+    {
+        return -1;
+    }
+    char *end;
+    errno = 0;
+    long long number = strtoll(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE)
+    {
+        return -1;
+    }
+    *value = number;
+    return 0;
+}
+
+/**
+ * Parses the seed, any value of 64 bits.
+ *
+ * @return int - 0 if the whole text is a number that fits, -1 otherwise
+ */
+static int parse_seed(const char *text, uint64_t *seed)
+{
+    if (*text < '0' || *text > '9')
+    {
+        return -1;
+    }
+    char *end;
+    errno = 0;
+    unsigned long long number = strtoull(text, &end, 10);
+    if (*end != '\0' || errno == ERANGE)
+    {
+        return -1;
+    }
+    *seed = number;
+    return 0;
+}
+
+/**
+ * Parses the N/P ratio, a positive number.
+ *
+ * @return int - 0 if the whole text is a finite number above 0, -1 otherwise
+ */
+static int parse_ratio(const char *text, double *ratio)
+{
+    char *end;
+    errno = 0;
+    double number = strtod(text, &end);
+    if (end == text || *end != '\0' || errno == ERANGE || !isfinite(number) || number <= 0)
+    {
+        return -1;
+    }
+    *ratio = number;
+    return 0;
+}
+
+/**
+ * Generates a valid hive config. T_i and X_i are drawn from the chosen
+ * distributions and clamped to the limits the hive loads with, P follows from
+ * the N/P ratio, which must be at least 2, unless it is given.
+ */
+int main(int argc, char *argv[])
+{
+    config_limits limits = {
+        .max_number = DEFAULT_MAX_NUMBER,
+        .min_duration = DEFAULT_MIN_DURATION,
+        .max_duration = DEFAULT_MAX_DURATION};
+    distribution time_in_hive = {.kind = DISTRIBUTION_CONSTANT, .first = NS_PER_SECOND};
+    distribution life_span = {.kind = DISTRIBUTION_CONSTANT, .first = 10};
+    long long number_of_bees = DEFAULT_NUMBER_OF_BEES;
+    long long capacity = 0;
+    long long gates = DEFAULT_GATES_NUMBER;
+    long long new_bee_interval = 4 * NS_PER_SECOND;
+    double ratio = DEFAULT_RATIO;
+    uint64_t seed = 1;
+    int binary = 0;
+    const char *output = NULL;
+
+    int option;
+    while ((option = getopt(argc, argv, "N:P:r:T:t:x:g:s:n:d:bo:")) != -1)
+    {
+        switch (option)
+        {
+        case 'N':
+            if (parse_number(optarg, &number_of_bees) == -1)
+            {
+                invalid_option(argv[0], "number of bees", optarg);
+            }
+            break;
+        case 'P':
+            if (parse_number(optarg, &capacity) == -1)
+            {
+                invalid_option(argv[0], "capacity", optarg);
+            }
+            break;
+        case 'r':
+            if (parse_ratio(optarg, &ratio) == -1)
+            {
+                invalid_option(argv[0], "ratio", optarg);
+            }
+            break;
+        case 'T':
+            if (parse_duration(optarg, &new_bee_interval) == -1)
+            {
+                fprintf(stderr, "Invalid new bee interval %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 't':
+            if (parse_distribution(optarg, 1, &time_in_hive) == -1)
+            {
+                fprintf(stderr, "Invalid distribution of T_i %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'x':
+            if (parse_distribution(optarg, 0, &life_span) == -1)
+            {
+                fprintf(stderr, "Invalid distribution of X_i %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'g':
+            if (parse_number(optarg, &gates) == -1)
+            {
+                invalid_option(argv[0], "number of gates", optarg);
+            }
+            break;
+        case 's':
+            if (parse_seed(optarg, &seed) == -1)
+            {
+                invalid_option(argv[0], "seed", optarg);
+            }
+            break;
+        case 'n':
+            if (parse_number(optarg, &limits.max_number) == -1)
+            {
+                invalid_option(argv[0], "maximum number", optarg);
+            }
+            break;
+        case 'd':
+            if (parse_duration(optarg, &limits.max_duration) == -1)
+            {
+                fprintf(stderr, "Invalid maximum duration %s\n", optarg);
+                return 1;
+            }
+            break;
+        case 'b':
+            binary = 1;
+            break;
+        case 'o':
+            output = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind != argc)
+    {
+        usage(argv[0]);
+    }
+
+    if (limits.max_number < 1 || limits.max_number > INT_MAX)
+    {
+        fprintf(stderr, "Invalid maximum number\n");
+        return 1;
+    }
+    if (number_of_bees < 2 || number_of_bees > limits.max_number)
+    {
+        fprintf(stderr, "Invalid number of bees (N), must be in [2 %lld]\n", limits.max_number);
+        return 1;
+    }
+    if (capacity == 0)
+    {
+        if (ratio < 2)
+        {
+            fprintf(stderr, "Invalid N/P ratio, must be at least 2\n");
+            return 1;
+        }
+        capacity = (long long)(number_of_bees / ratio);
+        capacity = capacity < 1 ? 1 : capacity;
+    }
+    if (capacity < 1 || number_of_bees < 2 * capacity)
+    {
+        fprintf(stderr, "Invalid maximum hive capacity (P), N must be at least 2P\n");
+        return 1;
+    }
+    if (gates < 1 || gates > MAX_GATES)
+    {
+        fprintf(stderr, "Invalid number of gates (G), at most %d gates are supported\n", MAX_GATES);
+        return 1;
+    }
+    if (binary && output == NULL)
+    {
+        fprintf(stderr, "The binary config needs an output file\n");
+        return 1;
+    }
+
+    hive_config config = {
+        .max_bees_capacity = capacity,
+        .number_of_bees = number_of_bees,
+        .new_bee_interval = clamp(new_bee_interval, limits.min_duration, limits.max_duration),
+        .gates_number = gates,
+        .bees = malloc(number_of_bees * sizeof(bee_config))};
+    if (config.bees == NULL)
+    {
+        fprintf(stderr, "Memory allocation failed for bees\n");
+        return 1;
+    }
+
+    random_state = seed;
+    for (int i = 0; i < config.number_of_bees; i++)
+    {
+        config.bees[i].time_in_hive = clamp(sample(&time_in_hive), limits.min_duration, limits.max_duration);
+    }
+    for (int i = 0; i < config.number_of_bees; i++)
+    {
+        config.bees[i].life_span = clamp(sample(&life_span), 1, limits.max_number);
+    }
+
+    int result;
+    if (binary)
+    {
+        result = save_binary_config(output, &config);
+    }
+    else
+    {
+        FILE *file = output ? fopen(output, "w") : stdout;
+        result = file ? write_text_config(file, &config) : -1;
+        if (file && file != stdout && fclose(file) != 0)
+        {
+            result = -1;
+        }
+    }
+    free(config.bees);
+    if (result == -1)
+    {
+        fprintf(stderr, "Error writing the config: %s\n", strerror(errno));
+        return 1;
+    }
+    return 0;
+}
@@ -1,4 +1,5 @@
 #include "hive_ipc.h"
+#include "futex.h"
 #include "logger/logger.h"
 
 #include <sys/types.h>
@@ -9,50 +10,71 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
-#include <semaphore.h>
 #include <fcntl.h>
+#include <sys/mman.h>
 
-int open_semaphores(int max_bees)
+#define SHARED_MEMORY_NAME "/hive_shared"
+
+int queen_message_queue;
+hive_shared_memory *hive_shared;
+
+int initialize_gate_message_queues(int gates)
 {
-    room_inside_semaphore = sem_open("/room_inside_semaphore", O_CREAT, 0666, max_bees);
-    if (room_inside_semaphore == SEM_FAILED)
+    hive_shared->gate_count = gates;
+    for (int i = 0; i < gates; i++)
     {
-        log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
-        return -1;
+        hive_shared->gate_message_queue[i] = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
+        if (hive_shared->gate_message_queue[i] == -1)
+        {
+            log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
+            hive_shared->gate_count = i;
+            return -1;
+        }
     }
-    gate_semaphore[0] = sem_open("/gate_semaphore_0", O_CREAT, 0666, 1);
-    if (gate_semaphore[0] == SEM_FAILED)
+    return 0;
+}
+
+int initialize_pool_message_queue()
+{
+    hive_shared->pool_message_queue = msgget(IPC_PRIVATE, IPC_CREAT | 0666);
+    if (hive_shared->pool_message_queue == -1)
     {
         log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
         return -1;
     }
-    gate_semaphore[1] = sem_open("/gate_semaphore_1", O_CREAT, 0666, 1);
-    if (gate_semaphore[1] == SEM_FAILED)
+    return 0;
+}
+
+int claim_idle_bee()
+{
+    int idle = atomic_load(&hive_shared->idle_bees);
+    while (idle > 0)
     {
-        log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
-        return -1;
+        if (atomic_compare_exchange_weak(&hive_shared->idle_bees, &idle, idle - 1))
+        {
+            return 1;
+        }
     }
-
     return 0;
 }
 
-int initialize_gate_message_queue()
+void record_bee_launch(int kind, long long requested_at, long long started_at)
 {
-    key_t key_1 = ftok("hive", 65);
-    gate_message_queue[0] = msgget(key_1, IPC_CREAT | 0666);
-    if (gate_message_queue[0] == -1)
+    launch_statistics *statistics = &hive_shared->launches[kind];
+    uint64_t latency = started_at > requested_at ? started_at - requested_at : 0;
+    atomic_fetch_add_explicit(&statistics->total_latency, latency, memory_order_relaxed);
+    uint64_t max_latency = atomic_load_explicit(&statistics->max_latency, memory_order_relaxed);
+    while (latency > max_latency &&
+           !atomic_compare_exchange_weak(&statistics->max_latency, &max_latency, latency))
     {
-        log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
-        return -1;
     }
-    key_t key_2 = ftok("hive", 66);
-    gate_message_queue[1] = msgget(key_2, IPC_CREAT | 0666);
-    if (gate_message_queue[1] == -1)
+    uint64_t last = atomic_load_explicit(&statistics->last_started_at, memory_order_relaxed);
+    while ((uint64_t)started_at > last &&
+           !atomic_compare_exchange_weak(&statistics->last_started_at, &last, started_at))
     {
-        log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
-        return -1;
     }
-    return 0;
+    // Counted last, a reader that sees the bee started also sees its times.
+    atomic_fetch_add(&statistics->started, 1);
 }
 
 int initialize_queen_message_queue()
@@ -67,54 +89,443 @@ int initialize_queen_message_queue()
     return 0;
 }
 
-void close_semaphores()
+void close_gate_message_queues()
 {
-    if (sem_close(room_inside_semaphore) == -1)
+    if (hive_shared == NULL)
     {
-        log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
+        return;
+    }
+    for (int i = 0; i < hive_shared->gate_count; i++)
+    {
+        if (msgctl(hive_shared->gate_message_queue[i], IPC_RMID, NULL) == -1)
+        {
+            log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
+        }
+    }
+}
+
+void close_pool_message_queue()
+{
+    if (hive_shared == NULL || hive_shared->pool_message_queue == -1)
+    {
+        return;
     }
-    if (sem_close(gate_semaphore[0]) == -1)
+    if (msgctl(hive_shared->pool_message_queue, IPC_RMID, NULL) == -1)
     {
         log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
     }
-    if (sem_close(gate_semaphore[1]) == -1)
+    hive_shared->pool_message_queue = -1;
+}
+
+void close_queen_message_queue() 
+{
+    if (msgctl(queen_message_queue, IPC_RMID, NULL) == -1) 
     {
         log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
     }
 }
 
-void unlink_semaphores()
+/**
+ * @return name of the memory shared by the hive, the bees and the queen
+ */
+static const char *shared_memory_name()
+{
+    const char *name = getenv(HIVE_SHM_VARIABLE);
+    return name != NULL && name[0] == '/' ? name : SHARED_MEMORY_NAME;
+}
+
+int open_shared_memory(int create)
 {
-    if (sem_unlink("/room_inside_semaphore") == -1)
+    int shmfd = shm_open(shared_memory_name(), create ? O_CREAT | O_RDWR : O_RDWR, 0666);
+    if (shmfd == -1)
     {
         log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
+        return -1;
     }
-    if (sem_unlink("/gate_semaphore_0") == -1)
+    if (create && ftruncate(shmfd, sizeof(hive_shared_memory)) == -1)
     {
         log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
+        close(shmfd);
+        return -1;
     }
-    if (sem_unlink("/gate_semaphore_1") == -1)
+    hive_shared = mmap(NULL, sizeof(hive_shared_memory), PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
+    close(shmfd);
+    if (hive_shared == MAP_FAILED)
     {
+        hive_shared = NULL;
         log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
+        return -1;
     }
+
+    if (create)
+    {
+        atomic_init(&hive_shared->occupancy, OCCUPANCY(0, 0));
+        atomic_init(&hive_shared->room_released, 0);
+        atomic_init(&hive_shared->room_waiters, 0);
+        hive_shared->transport = TRANSPORT_SHARED_MEMORY;
+        hive_shared->gate_count = 0;
+        hive_shared->pool_message_queue = -1;
+        hive_shared->hive_pid = getpid();
+        hive_shared->max_capacity = 0;
+        atomic_init(&hive_shared->idle_bees, 0);
+        for (int i = 0; i < 2; i++)
+        {
+            atomic_init(&hive_shared->launches[i].started, 0);
+            atomic_init(&hive_shared->launches[i].total_latency, 0);
+            atomic_init(&hive_shared->launches[i].max_latency, 0);
+            atomic_init(&hive_shared->launches[i].last_started_at, 0);
+        }
+        for (int i = 0; i < MAX_GATES; i++)
+        {
+            atomic_init(&hive_shared->gates[i].requests, 0);
+            atomic_init(&hive_shared->gates[i].gate_sleeping, 0);
+            atomic_init(&hive_shared->gates[i].tickets, 0);
+            atomic_init(&hive_shared->gates[i].slot_freed, 0);
+            atomic_init(&hive_shared->gates[i].slot_waiters, 0);
+            atomic_init(&hive_shared->gates[i].waiting, 0);
+            atomic_init(&hive_shared->gates[i].direction, 0);
+            atomic_init(&hive_shared->gates[i].bees_delta, 0);
+            for (int j = 0; j < GATE_SLOTS; j++)
+            {
+                atomic_init(&hive_shared->gates[i].slots[j].state, SLOT_FREE);
+            }
+        }
+    }
+    return 0;
+}
+
+/**
+ * @return expected wait at the gate for a bee going in the direction of delta
+ */
+static int gate_cost(int gate_id, int delta)
+{
+    gate_control_block *gate = &hive_shared->gates[gate_id];
+    int cost = atomic_load_explicit(&gate->waiting, memory_order_relaxed);
+    int direction = atomic_load_explicit(&gate->direction, memory_order_relaxed);
+    return direction != 0 && direction != delta ? cost + 1 : cost;
 }
 
-void close_gate_message_queue()
+int choose_gate(int delta)
 {
-    if (msgctl(gate_message_queue[0], IPC_RMID, NULL) == -1)
+    int gates = hive_shared->gate_count;
+    if (gates == 1)
     {
-        log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
+        return 0;
+    }
+    int first = rand() % gates;
+    int second = (first + 1 + rand() % (gates - 1)) % gates;
+    return gate_cost(second, delta) < gate_cost(first, delta) ? second : first;
+}
+
+void join_gate(int gate_id)
+{
+    atomic_fetch_add_explicit(&hive_shared->gates[gate_id].waiting, 1, memory_order_relaxed);
+}
+
+void pass_gate(int gate_id, int delta)
+{
+    gate_control_block *gate = &hive_shared->gates[gate_id];
+    atomic_fetch_sub_explicit(&gate->waiting, 1, memory_order_relaxed);
+    atomic_store_explicit(&gate->direction, delta, memory_order_relaxed);
+}
+
+int next_direction(gate_schedule *schedule, int entering, int leaving)
+{
+    if (entering == 0 && leaving == 0)
+    {
+        return 0;
+    }
+
+    int direction = schedule->direction;
+    uint64_t occupancy = read_occupancy();
+    if (leaving > 0 && OCCUPANCY_COUNT(occupancy) >= OCCUPANCY_CAPACITY(occupancy))
+    {
+        direction = -1;
+    }
+    else if ((direction == 1 ? entering : leaving) == 0)
+    {
+        direction = -direction;
+    }
+    else if (schedule->platoon >= MAX_PLATOON_SIZE && (direction == 1 ? leaving : entering) > 0)
+    {
+        direction = -direction;
+    }
+
+    if (direction != schedule->direction)
+    {
+        schedule->direction = direction;
+        schedule->platoon = 0;
+    }
+    schedule->platoon++;
+    return direction;
+}
+
+/**
+ * Claims a free slot of the gate, bees start looking at different slots to
+ * avoid contending on the same one. When all the slots are taken the bee
+ * sleeps until one is freed.
+ *
+ * @return gate_slot* - the claimed slot, NULL with errno set to EINTR if a
+ *         signal arrived while waiting
+ */
+static gate_slot *claim_gate_slot(gate_control_block *gate)
+{
+    const struct timespec timeout = {.tv_sec = 0, .tv_nsec = ROOM_WAIT_TIMEOUT_NS};
+    int start = getpid() % GATE_SLOTS;
+    for (;;)
+    {
+        uint32_t freed = atomic_load(&gate->slot_freed);
+        for (int i = 0; i < GATE_SLOTS; i++)
+        {
+            gate_slot *slot = &gate->slots[(start + i) % GATE_SLOTS];
+            uint32_t state = SLOT_FREE;
+            if (atomic_load_explicit(&slot->state, memory_order_relaxed) == SLOT_FREE &&
+                atomic_compare_exchange_strong(&slot->state, &state, SLOT_CLAIMED))
+            {
+                return slot;
+            }
+        }
+
+        atomic_fetch_add(&gate->slot_waiters, 1);
+        int result = futex_wait(&gate->slot_freed, freed, &timeout);
+        int error = errno;
+        atomic_fetch_sub(&gate->slot_waiters, 1);
+        if (result == -1 && error == EINTR)
+        {
+            errno = EINTR;
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Wakes up a bee waiting for a slot, once a slot of the gate was freed.
+ */
+static void announce_free_slot(gate_control_block *gate)
+{
+    atomic_fetch_add(&gate->slot_freed, 1);
+    if (atomic_load(&gate->slot_waiters))
+    {
+        futex_wake(&gate->slot_freed, 1);
     }
+}
+
+int cross_gate_shared(int gate_id, int delta)
+{
+    gate_control_block *gate = &hive_shared->gates[gate_id];
+    gate_slot *slot = claim_gate_slot(gate);
+    if (slot == NULL)
+    {
+        return -1;
+    }
+    slot->delta = delta;
+    slot->ticket = atomic_fetch_add(&gate->tickets, 1);
+    atomic_store(&slot->state, SLOT_REQUESTED);
+
+    atomic_fetch_add(&gate->requests, 1);
+    if (atomic_load(&gate->gate_sleeping))
+    {
+        futex_wake(&gate->requests, 1);
+    }
+
+    uint32_t current;
+    while ((current = atomic_load(&slot->state)) != SLOT_GRANTED)
+    {
+        if (futex_wait(&slot->state, current, NULL) == -1 && errno == EINTR && current == SLOT_REQUESTED)
+        {
+            // Withdraw the request unless the hive granted it in the meantime.
+            uint32_t state = SLOT_REQUESTED;
+            if (atomic_compare_exchange_strong(&slot->state, &state, SLOT_FREE))
+            {
+                announce_free_slot(gate);
+                atomic_fetch_sub_explicit(&gate->waiting, 1, memory_order_relaxed);
+                errno = EINTR;
+                return -1;
+            }
+        }
+    }
+    atomic_store(&slot->state, SLOT_FREE);
+    announce_free_slot(gate);
+    return 0;
+}
+
+void wait_for_gate_requests(int gate_id, uint32_t requests)
+{
+    gate_control_block *gate = &hive_shared->gates[gate_id];
+    struct timespec timeout = {.tv_sec = 1, .tv_nsec = 0};
+
+    atomic_store(&gate->gate_sleeping, 1);
+    if (atomic_load(&gate->requests) == requests)
+    {
+        // The timeout lets the gate thread notice SIGINT.
+        futex_wait(&gate->requests, requests, &timeout);
+    }
+    atomic_store(&gate->gate_sleeping, 0);
+}
 
-    if (msgctl(gate_message_queue[1], IPC_RMID, NULL) == -1)
+void wake_gate_threads()
+{
+    for (int i = 0; i < hive_shared->gate_count; i++)
+    {
+        gate_control_block *gate = &hive_shared->gates[i];
+        atomic_fetch_add(&gate->requests, 1);
+        futex_wake(&gate->requests, INT_MAX);
+    }
+}
+
+int take_gate_request(gate_slot *slot)
+{
+    uint32_t state = SLOT_REQUESTED;
+    return atomic_load_explicit(&slot->state, memory_order_relaxed) == SLOT_REQUESTED &&
+           atomic_compare_exchange_strong(&slot->state, &state, SLOT_TAKEN);
+}
+
+void grant_gate_request(gate_slot *slot)
+{
+    atomic_store(&slot->state, SLOT_GRANTED);
+    futex_wake(&slot->state, 1);
+}
+
+int reserve_rooms(uint32_t count, volatile sig_atomic_t *stop)
+{
+    const struct timespec timeout = {.tv_sec = 0, .tv_nsec = ROOM_WAIT_TIMEOUT_NS};
+    uint64_t occupancy = atomic_load(&hive_shared->occupancy);
+    for (;;)
+    {
+        if (OCCUPANCY_COUNT(occupancy) < OCCUPANCY_CAPACITY(occupancy))
+        {
+            uint32_t free_rooms = OCCUPANCY_CAPACITY(occupancy) - OCCUPANCY_COUNT(occupancy);
+            uint32_t reserved = count < free_rooms ? count : free_rooms;
+            if (atomic_compare_exchange_weak(&hive_shared->occupancy, &occupancy, occupancy + reserved))
+            {
+                return reserved;
+            }
+            continue;
+        }
+        if (*stop)
+        {
+            errno = EINTR;
+            return -1;
+        }
+
+        // The hive is full, sleep until a bee releases its room or the capacity grows.
+        uint32_t released = atomic_load(&hive_shared->room_released);
+        atomic_fetch_add(&hive_shared->room_waiters, 1);
+        if (atomic_load(&hive_shared->occupancy) == occupancy)
+        {
+            futex_wait(&hive_shared->room_released, released, &timeout);
+        }
+        atomic_fetch_sub(&hive_shared->room_waiters, 1);
+        occupancy = atomic_load(&hive_shared->occupancy);
+    }
+}
+
+int reserve_room(volatile sig_atomic_t *stop)
+{
+    return reserve_rooms(1, stop) == -1 ? -1 : 0;
+}
+
+int try_reserve_rooms(uint32_t count)
+{
+    uint64_t occupancy = atomic_load(&hive_shared->occupancy);
+    while (OCCUPANCY_COUNT(occupancy) < OCCUPANCY_CAPACITY(occupancy))
+    {
+        uint32_t free_rooms = OCCUPANCY_CAPACITY(occupancy) - OCCUPANCY_COUNT(occupancy);
+        uint32_t reserved = count < free_rooms ? count : free_rooms;
+        if (atomic_compare_exchange_weak(&hive_shared->occupancy, &occupancy, occupancy + reserved))
+        {
+            return reserved;
+        }
+    }
+    return 0;
+}
+
+int try_reserve_room()
+{
+    return try_reserve_rooms(1) == 1 ? 0 : -1;
+}
+
+void release_room()
+{
+    atomic_fetch_sub(&hive_shared->occupancy, 1);
+    atomic_fetch_add(&hive_shared->room_released, 1);
+    if (atomic_load(&hive_shared->room_waiters))
+    {
+        futex_wake(&hive_shared->room_released, 1);
+    }
+}
+
+void set_room_capacity(uint32_t capacity)
+{
+    uint64_t occupancy = atomic_load(&hive_shared->occupancy);
+    while (!atomic_compare_exchange_weak(&hive_shared->occupancy, &occupancy,
+                                         OCCUPANCY(OCCUPANCY_COUNT(occupancy), capacity)))
+    {
+    }
+    atomic_fetch_add(&hive_shared->room_released, 1);
+    if (atomic_load(&hive_shared->room_waiters))
+    {
+        futex_wake(&hive_shared->room_released, INT_MAX);
+    }
+}
+
+uint32_t scale_room_capacity(int grow, uint32_t max_capacity)
+{
+    uint64_t occupancy = atomic_load(&hive_shared->occupancy);
+    uint32_t capacity;
+    do
+    {
+        capacity = OCCUPANCY_CAPACITY(occupancy);
+        if (grow)
+        {
+            capacity = capacity > max_capacity / 2 ? max_capacity : 2 * capacity;
+        }
+        else
+        {
+            capacity = capacity > 1 ? capacity / 2 : 1;
+        }
+    } while (!atomic_compare_exchange_weak(&hive_shared->occupancy, &occupancy,
+                                           OCCUPANCY(OCCUPANCY_COUNT(occupancy), capacity)));
+
+    // Extra bees inside leave as usual, nobody gets in until the count drops below the capacity.
+    if (grow)
+    {
+        atomic_fetch_add(&hive_shared->room_released, 1);
+        if (atomic_load(&hive_shared->room_waiters))
+        {
+            futex_wake(&hive_shared->room_released, INT_MAX);
+        }
+    }
+    return capacity;
+}
+
+uint64_t read_occupancy()
+{
+    return atomic_load(&hive_shared->occupancy);
+}
+
+int count_bees_inside()
+{
+    int bees_inside = 0;
+    for (int i = 0; i < hive_shared->gate_count; i++)
+    {
+        bees_inside += atomic_load_explicit(&hive_shared->gates[i].bees_delta, memory_order_relaxed);
+    }
+    return bees_inside;
+}
+
+void close_shared_memory()
+{
+    if (hive_shared != NULL && munmap(hive_shared, sizeof(hive_shared_memory)) == -1)
     {
         log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
     }
+    hive_shared = NULL;
 }
 
-void close_queen_message_queue() 
+void unlink_shared_memory()
 {
-    if (msgctl(queen_message_queue, IPC_RMID, NULL) == -1) 
+    if (shm_unlink(shared_memory_name()) == -1)
     {
         log(LOG_LEVEL_ERROR, "HIVE_IPC", "ERROR %s at %s\n", strerror(errno), __func__);
     }
@@ -1,5 +1,7 @@
 
-#include <semaphore.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <signal.h>
 
 #ifndef HIVE_IPC_H
 #define HIVE_IPC_H
@@ -7,23 +9,110 @@
 #define USED_GATE_TYPE 1
 #define ACK_TYPE 2
 #define GIVE_BIRTH 3
-#define GATES_NUMBER 2
+
+/**
+ * Signals the beekeeper sends the hive to add and remove frames, see
+ * scale_room_capacity.
+ */
+#define ADD_FRAMES_SIGNAL SIGUSR1
+#define REMOVE_FRAMES_SIGNAL SIGUSR2
+
+/**
+ * Number of gates when the hive config does not set it, and the most gates
+ * a hive can have.
+ */
+#define DEFAULT_GATES_NUMBER 2
+#define MAX_GATES 64
+
+/**
+ * How the bees ask the hive to cross a gate. TRANSPORT_SHARED_MEMORY uses the
+ * gate control blocks in the shared memory segment, TRANSPORT_MESSAGE_QUEUE
+ * the gate message queues.
+ */
+#define TRANSPORT_MESSAGE_QUEUE 0
+#define TRANSPORT_SHARED_MEMORY 1
+
+#define CACHE_LINE_SIZE 64
+
+/**
+ * Number of bees that can wait for the same gate at once in shared memory
+ * transport, the others sleep until a slot is freed.
+ */
+#define GATE_SLOTS 64
+
+#define SLOT_FREE 0
+#define SLOT_CLAIMED 1
+#define SLOT_REQUESTED 2
+#define SLOT_TAKEN 3
+#define SLOT_GRANTED 4
 
 /**
  * Structure representing the message to coordinate the usage of the gates.
  * The delta field represents the number of bees entering or leaving the hive.
  * It is either 1 or -1.
- * 
- * Type is either USED_GATE_TYPE - sent by bee process or ACK_TYPE sent by hive.
+ *
+ * Type is either USED_GATE_TYPE - sent by bee process or ACK_TYPE + pid of
+ * the bee - sent by hive, so that every bee receives only its own ACK.
  */
 typedef struct
 {
     long type;
     int delta;
+    int pid;
 } gate_message;
 
+#define GATE_MESSAGE_SIZE (sizeof(gate_message) - sizeof(long))
+
+/**
+ * Maximum number of gate requests the hive takes out of the queue before it
+ * acknowledges them.
+ */
+#define GATE_BATCH_SIZE 64
+
 /**
- * Structure representing the message sent by the queen to the hive 
+ * Message types of the bee pool queue. POOL_SPAWN_TYPE goes to the fork server
+ * that forks a new bee for the assignment, POOL_ASSIGN_TYPE goes to any idle
+ * bee process.
+ */
+#define POOL_SPAWN_TYPE 1
+#define POOL_ASSIGN_TYPE 2
+
+/**
+ * Bee handed to the pool, the same parameters as the arguments of ./bin/bee.
+ */
+typedef struct
+{
+    long type;
+    int id;
+    int life_span;
+    int starts_in_hive;
+    long long time_in_hive;             /* in ns */
+    long long time_outside_hive;        /* in ns */
+    long long requested_at;             /* when the hive launched the bee, in ns of CLOCK_MONOTONIC */
+} bee_assignment;
+
+#define BEE_ASSIGNMENT_SIZE (sizeof(bee_assignment) - sizeof(long))
+
+/**
+ * How long bees took from being launched by the hive until they started.
+ * LAUNCH_INITIAL counts the bees of the config, LAUNCH_BIRTH the bees born
+ * from the queen.
+ */
+#define LAUNCH_INITIAL 0
+#define LAUNCH_BIRTH 1
+
+typedef struct
+{
+    _Atomic uint64_t started;
+    _Atomic uint64_t total_latency;     /* in ns */
+    _Atomic uint64_t max_latency;       /* in ns */
+    _Atomic uint64_t last_started_at;   /* in ns of CLOCK_MONOTONIC */
+} launch_statistics;
+
+/**
+ * Structure representing the message sent by the queen to the hive. A
+ * GIVE_BIRTH message carries the number of eggs in the clutch in data, the
+ * room for all of them is already reserved.
  */
 typedef struct
 {
@@ -32,40 +121,145 @@ typedef struct
 } queen_message;
 
 /**
- * global variable for the message queue used to communicate with the queen
+ * Request of a single bee in a gate control block. The bee claims a free slot,
+ * stores the delta and marks it requested. The hive takes the request, after
+ * which the bee can no longer withdraw it, and marks it granted once the bee
+ * crossed the gate. The state is the futex word the bee waits on.
+ */
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t state;
+    int delta;
+    uint32_t ticket;                /* order of the request at its gate */
+} gate_slot;
+
+/**
+ * State of a single gate. Every request bumps the requests counter, which is
+ * the futex word the gate thread of the hive sleeps on.
+ *
+ * Each gate counts the bees that entered minus the bees that left through it
+ * on its own cache line, so gate threads never contend on a shared counter.
+ * The number of bees inside is the sum over all gates, see count_bees_inside.
+ *
+ * Bees count themselves in waiting before they ask for the gate and the hive
+ * counts them out once they are through, recording the direction they went.
+ * Bees use both to pick the gate with the shortest expected wait.
  */
-int queen_message_queue;
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t requests;
+    _Atomic uint32_t gate_sleeping;
+    _Atomic uint32_t tickets;       /* next ticket handed out to a request */
+    _Alignas(CACHE_LINE_SIZE) _Atomic int waiting;
+    _Atomic int direction;          /* delta of the last bee let through */
+    _Alignas(CACHE_LINE_SIZE) _Atomic int bees_delta;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t slot_freed;  /* futex word, bumped whenever a slot is freed */
+    _Atomic uint32_t slot_waiters;                          /* number of bees waiting for a free slot */
+    gate_slot slots[GATE_SLOTS];
+} gate_control_block;
 
 /**
- * global variable for the message queue used to communicate between the gates
- * and the hive
+ * Longest a waiter sleeps on a futex of the hive before it checks again
+ * whether it should stop.
  */
-int gate_message_queue[GATES_NUMBER];
+#define ROOM_WAIT_TIMEOUT_NS 100000000LL
 
 /**
- * global variable for the semaphore used to control access the gates of the hive
+ * Builds the occupancy word out of the number of bees and the capacity.
  */
-sem_t *gate_semaphore[GATES_NUMBER];
+#define OCCUPANCY(count, capacity) (((uint64_t)(capacity) << 32) | (uint32_t)(count))
+#define OCCUPANCY_COUNT(occupancy) ((uint32_t)(occupancy))
+#define OCCUPANCY_CAPACITY(occupancy) ((uint32_t)((occupancy) >> 32))
 
 /**
- * global variable for the semaphore used to control the number of bees inside
- * the hive
+ * Most bees a gate lets through in one direction in a row while bees wait to
+ * go the other way.
  */
-sem_t *room_inside_semaphore;
+#define MAX_PLATOON_SIZE 8
 
 /**
- * Initialzes the semaphores used in the hive
+ * Direction a gate currently lets bees through and how many bees went that
+ * way since it last switched.
+ */
+typedef struct
+{
+    int direction;
+    int platoon;
+} gate_schedule;
+
+/**
+ * Memory shared by the hive, the bees and the queen. The hive fills in the
+ * transport, the gate count, the ids of the gate message queues and the
+ * capacity before it launches any bee.
  *
- * @return int - 0 if the semaphores were successfully initialized, -1 otherwise
+ * The occupancy word holds the capacity of the hive in the upper half and
+ * the number of bees inside, on their way in or not hatched yet in the lower
+ * half. Room is reserved and released with a compare-and-swap on the whole
+ * word, so the count never exceeds the capacity. Bees only go to sleep on
+ * room_released when the hive is full.
  */
-int open_semaphores(int);
+typedef struct
+{
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t occupancy;
+    _Atomic uint32_t room_released;     /* futex word, bumped whenever room is freed */
+    _Atomic uint32_t room_waiters;      /* number of bees waiting for room */
+    _Alignas(CACHE_LINE_SIZE) int transport;
+    int gate_count;
+    int gate_message_queue[MAX_GATES];
+    int pool_message_queue;             /* -1 unless the bees run in the pool */
+    int hive_pid;                       /* process the beekeeper signals */
+    uint32_t max_capacity;              /* most room the beekeeper can make, 2N */
+    _Atomic int idle_bees;              /* pool processes waiting for a bee to run */
+    launch_statistics launches[2];
+    gate_control_block gates[MAX_GATES];
+} hive_shared_memory;
 
 /**
- * Initializes the message queue used to communicate between the gates and the hive
+ * global variable for the message queue used to communicate with the queen
+ */
+extern int queen_message_queue;
+
+/**
+ * global variable for the memory shared by the hive, the bees and the queen
+ */
+extern hive_shared_memory *hive_shared;
+
+/**
+ * Creates one message queue per gate used to communicate between the gates
+ * and the hive, and stores their ids in the shared memory for the bees.
+ * Should be used by the hive process only, after open_shared_memory.
+ *
+ * @param gates - number of gates
+ * @return int - 0 if the message queues were successfully initialized, -1 otherwise
+ */
+int initialize_gate_message_queues(int gates);
+
+/**
+ * Creates the message queue the hive uses to hand bees to the pool and stores
+ * its id in the shared memory. Should be used by the hive process only, after
+ * open_shared_memory.
  *
  * @return int - 0 if the message queue was successfully initialized, -1 otherwise
  */
-int initialize_gate_message_queue();
+int initialize_pool_message_queue();
+
+/**
+ * Takes one of the idle pool processes for a new bee. Every idle process
+ * takes exactly one POOL_ASSIGN_TYPE message, so the hive may only send one
+ * after a successful claim.
+ *
+ * @return int - 1 if an idle process was claimed, 0 if there was none
+ */
+int claim_idle_bee();
+
+/**
+ * Records that a bee started.
+ *
+ * @param kind - LAUNCH_INITIAL or LAUNCH_BIRTH
+ * @param requested_at - when the hive launched the bee, in ns of CLOCK_MONOTONIC
+ * @param started_at - when the bee started, in ns of CLOCK_MONOTONIC
+ */
+void record_bee_launch(int kind, long long requested_at, long long started_at);
 
 /**
  * Initializes the message queue used to communicate with the queen
@@ -75,21 +269,183 @@ int initialize_gate_message_queue();
 int initialize_queen_message_queue();
 
 /**
- * Closes the semaphores used in the hive
+ * Name of the memory shared by the hive, the bees and the queen,
+ * "/hive_shared" unless the HIVE_SHM environment variable names another one
+ * starting with a slash. Children of the hive inherit it.
+ */
+#define HIVE_SHM_VARIABLE "HIVE_SHM"
+
+/**
+ * Maps the memory shared by the hive, the bees and the queen.
+ *
+ * @param create - 1 to create and initialize the memory, should be used by
+ *        the hive process only
+ * @return int - 0 if the memory was successfully mapped, -1 otherwise
+ */
+int open_shared_memory(int create);
+
+/**
+ * Picks the gate with the shortest expected wait out of two random gates.
+ * A gate costs one more when it last let bees through in the other direction.
+ *
+ * @param delta - 1 when entering the hive, -1 when leaving it
+ * @return int - id of the gate
+ */
+int choose_gate(int delta);
+
+/**
+ * Records that the bee waits for the gate, see choose_gate.
+ */
+void join_gate(int gate_id);
+
+/**
+ * Records that the hive let a bee through the gate in the direction of delta.
+ * Should be used by the hive process only.
+ */
+void pass_gate(int gate_id, int delta);
+
+/**
+ * Asks the hive to let the bee through the gate using the gate control block
+ * and waits until it is granted.
+ *
+ * @param gate_id - gate to cross
+ * @param delta - 1 when entering the hive, -1 when leaving it
+ * @return int - 0 once the bee crossed the gate, -1 with errno set to EINTR
+ *         if a signal arrived before the request was granted
+ */
+int cross_gate_shared(int gate_id, int delta);
+
+/**
+ * Waits until a bee adds a request to the gate control block. Should be used
+ * by the hive process only.
+ *
+ * @param gate_id - gate to wait for
+ * @param requests - value of the requests counter before the caller last
+ *        looked at the slots
+ */
+void wait_for_gate_requests(int gate_id, uint32_t requests);
+
+/**
+ * Wakes up all the gate threads waiting for requests, so that they notice
+ * the hive stops. Should be used by the hive process only.
+ */
+void wake_gate_threads();
+
+/**
+ * Takes the request in the slot if there is one. Should be used by the hive
+ * process only.
+ *
+ * @return int - 1 if the request was taken and must be granted, 0 otherwise
+ */
+int take_gate_request(gate_slot *slot);
+
+/**
+ * Marks a taken request as granted and wakes up its bee. Should be used by
+ * the hive process only.
+ */
+void grant_gate_request(gate_slot *slot);
+
+/**
+ * Reserves room for one bee in the hive, waiting while it is full.
+ *
+ * @param stop - flag set by the SIGINT handler of the caller
+ * @return int - 0 once the room is reserved, -1 with errno set to EINTR if
+ *         stop was set first
+ */
+int reserve_room(volatile sig_atomic_t *stop);
+
+/**
+ * Reserves room for up to count bees in the hive with a single
+ * compare-and-swap, taking as much of it as is free and waiting only while
+ * the hive is full. The wait is cut into ROOM_WAIT_TIMEOUT_NS slices with
+ * stop checked before each of them, so a signal that arrives just before the
+ * caller goes to sleep is not lost.
+ *
+ * @param count - most rooms to reserve, at least 1
+ * @param stop - flag set by the SIGINT handler of the caller
+ * @return int - number of rooms reserved, between 1 and count, or -1 with
+ *         errno set to EINTR if stop was set first
+ */
+int reserve_rooms(uint32_t count, volatile sig_atomic_t *stop);
+
+/**
+ * Reserves room for one bee in the hive if there is any, without waiting.
+ *
+ * @return int - 0 if the room is reserved, -1 if the hive is full
+ */
+int try_reserve_room();
+
+/**
+ * Reserves room for up to count bees in the hive with a single
+ * compare-and-swap, as much of it as is free, without waiting.
+ *
+ * @param count - most rooms to reserve
+ * @return int - number of rooms reserved, 0 if the hive is full
  */
-void close_semaphores();
+int try_reserve_rooms(uint32_t count);
 
 /**
- * Unlinks the semaphores used in the hive.
+ * Releases the room of one bee and wakes up a bee waiting for it.
+ */
+void release_room();
+
+/**
+ * Changes the capacity of the hive and wakes up the bees waiting for room.
+ * Bees already inside stay even if they no longer fit.
+ */
+void set_room_capacity(uint32_t capacity);
+
+/**
+ * Adds or removes frames: doubles the capacity of the hive, up to
+ * max_capacity, or halves it, down to 1, with a single compare-and-swap.
+ * Shrinking never waits for bees to leave, the extra bees inside leave as
+ * usual and no bee gets in until the count drops below the new capacity.
+ * Safe to use in a signal handler.
+ *
+ * @param grow - 1 to add frames, 0 to remove them
+ * @param max_capacity - most room the hive can have
+ * @return uint32_t - the new capacity
+ */
+uint32_t scale_room_capacity(int grow, uint32_t max_capacity);
+
+/**
+ * @return uint64_t - occupancy word, see OCCUPANCY_COUNT and OCCUPANCY_CAPACITY
+ */
+uint64_t read_occupancy();
+
+/**
+ * Chooses the direction of the next bee let through a gate. Bees going the
+ * same way form a platoon that passes back to back, the gate switches once
+ * nobody waits in its direction or the platoon reached MAX_PLATOON_SIZE while
+ * bees wait to go the other way. Leaving bees always go first when the hive
+ * is full, entering bees could not get in anyway. Should be used by the hive
+ * process only.
+ *
+ * @param schedule - state of the gate
+ * @param entering - number of bees waiting to enter
+ * @param leaving - number of bees waiting to leave
+ * @return int - 1 to let an entering bee through, -1 for a leaving bee, 0 if
+ *         nobody waits
+ */
+int next_direction(gate_schedule *schedule, int entering, int leaving);
+
+/**
+ * Closes the message queues used to communicate between the gates and the hive
  * Should be used by the hive process only.
  */
-void unlink_semaphores();
+void close_gate_message_queues();
+
+/**
+ * @return int - number of bees inside the hive, combined from the counters of
+ *         all gates
+ */
+int count_bees_inside();
 
 /**
- * Closes the message queue used to communicate between the gates and the hive
+ * Closes the message queue of the bee pool, if there is one.
  * Should be used by the hive process only.
  */
-void close_gate_message_queue();
+void close_pool_message_queue();
 
 /**
  * Closes the message queue used to communicate with the queen
@@ -97,4 +453,15 @@ void close_gate_message_queue();
  */
 void close_queen_message_queue();
 
+/**
+ * Unmaps the shared memory.
+ */
+void close_shared_memory();
+
+/**
+ * Removes the shared memory.
+ * Should be used by the hive process only.
+ */
+void unlink_shared_memory();
+
 #endif
\ No newline at end of file
@@ -0,0 +1,370 @@
+#include "hive_simulation.h"
+#include "logger/logger.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define log_tag "SIMULATION"
+
+#define EVENT_WANT_ENTER 0
+#define EVENT_WANT_LEAVE 1
+#define EVENT_LAY_EGG 2
+
+/**
+ * Index of the queen among the simulated bees, she only waits for room for
+ * her eggs.
+ */
+#define QUEEN 0
+
+typedef struct
+{
+    long long time;                 /* virtual ns */
+    long long sequence;             /* keeps events of the same time in the order they were scheduled */
+    int bee;
+    int type;
+} simulation_event;
+
+typedef struct
+{
+    int id;
+    long long time_in_hive;
+    int life_span;
+    int visits;
+    int next_waiting;               /* next in the queue of bees waiting for room, -1 at the end */
+} simulated_bee;
+
+typedef struct
+{
+    long long now;
+    long long sequence;
+    simulation_event *events;
+    int event_count;
+    int event_capacity;
+    simulated_bee *bees;
+    int bee_count;
+    int bee_capacity;
+    int next_bee_id;
+    int waiting_head;
+    int waiting_tail;
+    int waiting_count;
+    int occupancy;
+    int capacity;
+    long long new_bee_interval;
+    int clutch_size;
+    int gates_number;
+    int gate_direction[MAX_GATES];  /* direction of the last bee through the gate, 0 before the first */
+    bee_config (*hatch)();
+    simulation_report *report;
+} simulation;
+
+static int earlier(const simulation_event *a, const simulation_event *b)
+{
+    return a->time < b->time || (a->time == b->time && a->sequence < b->sequence);
+}
+
+static int schedule_event(simulation *sim, long long delay, int bee, int type)
+{
+    if (sim->event_count == sim->event_capacity)
+    {
+        int capacity = sim->event_capacity ? 2 * sim->event_capacity : 1024;
+        simulation_event *events = realloc(sim->events, capacity * sizeof(simulation_event));
+        if (events == NULL)
+        {
+            return -1;
+        }
+        sim->events = events;
+        sim->event_capacity = capacity;
+    }
+
+    simulation_event event = {.time = sim->now + delay, .sequence = sim->sequence++, .bee = bee, .type = type};
+    int i = sim->event_count++;
+    while (i > 0 && earlier(&event, &sim->events[(i - 1) / 2]))
+    {
+        sim->events[i] = sim->events[(i - 1) / 2];
+        i = (i - 1) / 2;
+    }
+    sim->events[i] = event;
+    return 0;
+}
+
+static simulation_event pop_event(simulation *sim)
+{
+    simulation_event first = sim->events[0];
+    simulation_event last = sim->events[--sim->event_count];
+    int i = 0;
+    for (;;)
+    {
+        int child = 2 * i + 1;
+        if (child >= sim->event_count)
+        {
+            break;
+        }
+        if (child + 1 < sim->event_count && earlier(&sim->events[child + 1], &sim->events[child]))
+        {
+            child++;
+        }
+        if (!earlier(&sim->events[child], &last))
+        {
+            break;
+        }
+        sim->events[i] = sim->events[child];
+        i = child;
+    }
+    sim->events[i] = last;
+    return first;
+}
+
+/**
+ * @return index of the new bee or -1 if there was no memory for it
+ */
+static int add_bee(simulation *sim, bee_config config)
+{
+    if (sim->bee_count == sim->bee_capacity)
+    {
+        int capacity = 2 * sim->bee_capacity;
+        simulated_bee *bees = realloc(sim->bees, capacity * sizeof(simulated_bee));
+        if (bees == NULL)
+        {
+            return -1;
+        }
+        sim->bees = bees;
+        sim->bee_capacity = capacity;
+    }
+
+    int index = sim->bee_count++;
+    sim->bees[index] = (simulated_bee){
+        .id = sim->next_bee_id++,
+        .time_in_hive = config.time_in_hive,
+        .life_span = config.life_span,
+        .visits = 0,
+        .next_waiting = -1};
+    return index;
+}
+
+/**
+ * @return expected wait at the gate for a bee going in the direction, as
+ *         gate_cost of the hive. Bees never queue at a simulated gate, only
+ *         turning the gate around costs.
+ */
+static int simulated_gate_cost(simulation *sim, int gate_id, int direction)
+{
+    int last = sim->gate_direction[gate_id];
+    return last != 0 && last != direction ? 1 : 0;
+}
+
+/**
+ * Picks the cheaper of two random gates, the same choice as choose_gate.
+ */
+static int choose_simulated_gate(simulation *sim, int direction)
+{
+    int gates = sim->gates_number;
+    if (gates == 1)
+    {
+        return 0;
+    }
+    int first = rand() % gates;
+    int second = (first + 1 + rand() % (gates - 1)) % gates;
+    return simulated_gate_cost(sim, second, direction) < simulated_gate_cost(sim, first, direction) ? second : first;
+}
+
+static void cross_gate(simulation *sim, int bee, int direction)
+{
+    int gate_id = choose_simulated_gate(sim, direction);
+    sim->gate_direction[gate_id] = direction;
+    sim->report->gate_crossings[gate_id]++;
+    log(LOG_LEVEL_DEBUG, log_tag, "[%lld.%06lld] Bee %d %s through the gate %d",
+        sim->now / NS_PER_SECOND, sim->now % NS_PER_SECOND / NS_PER_MICROSECOND, sim->bees[bee].id,
+        direction == 1 ? "entering" : "leaving", gate_id);
+}
+
+static void take_room(simulation *sim)
+{
+    sim->occupancy++;
+    if (sim->occupancy > sim->report->max_occupancy)
+    {
+        sim->report->max_occupancy = sim->occupancy;
+    }
+}
+
+/**
+ * Hatches a clutch once the room for its first egg is taken. The rest of the
+ * clutch gets as much of the free room as it needs, as reserve_rooms gives
+ * the queen.
+ */
+static int lay_clutch(simulation *sim)
+{
+    int eggs = 1;
+    while (eggs < sim->clutch_size && sim->occupancy < sim->capacity)
+    {
+        take_room(sim);
+        eggs++;
+    }
+
+    for (int i = 0; i < eggs; i++)
+    {
+        int born = add_bee(sim, sim->hatch());
+        if (born == -1)
+        {
+            return -1;
+        }
+        sim->report->births++;
+        log(LOG_LEVEL_DEBUG, log_tag, "[%lld.%06lld] Bee %d hatched",
+            sim->now / NS_PER_SECOND, sim->now % NS_PER_SECOND / NS_PER_MICROSECOND, sim->bees[born].id);
+        if (schedule_event(sim, sim->bees[born].time_in_hive, born, EVENT_WANT_LEAVE) == -1)
+        {
+            return -1;
+        }
+    }
+    return schedule_event(sim, sim->new_bee_interval, QUEEN, EVENT_LAY_EGG);
+}
+
+/**
+ * Lets the bee in, or hatches a clutch when the room was taken for an egg.
+ * The room must already be taken.
+ */
+static int enter(simulation *sim, int bee)
+{
+    if (bee == QUEEN)
+    {
+        return lay_clutch(sim);
+    }
+
+    cross_gate(sim, bee, 1);
+    sim->report->entries++;
+    return schedule_event(sim, sim->bees[bee].time_in_hive, bee, EVENT_WANT_LEAVE);
+}
+
+static int want_room(simulation *sim, int bee)
+{
+    if (sim->occupancy < sim->capacity)
+    {
+        take_room(sim);
+        return enter(sim, bee);
+    }
+
+    sim->bees[bee].next_waiting = -1;
+    if (sim->waiting_tail == -1)
+    {
+        sim->waiting_head = bee;
+    }
+    else
+    {
+        sim->bees[sim->waiting_tail].next_waiting = bee;
+    }
+    sim->waiting_tail = bee;
+    sim->waiting_count++;
+    if (sim->waiting_count > sim->report->max_waiting_for_room)
+    {
+        sim->report->max_waiting_for_room = sim->waiting_count;
+    }
+    return 0;
+}
+
+static int leave(simulation *sim, int bee)
+{
+    simulated_bee *leaving = &sim->bees[bee];
+    cross_gate(sim, bee, -1);
+    sim->report->exits++;
+    sim->occupancy--;
+    leaving->visits++;
+    if (leaving->visits >= leaving->life_span)
+    {
+        sim->report->deaths++;
+        log(LOG_LEVEL_DEBUG, log_tag, "[%lld.%06lld] Bee %d dead",
+            sim->now / NS_PER_SECOND, sim->now % NS_PER_SECOND / NS_PER_MICROSECOND, leaving->id);
+    }
+    else if (schedule_event(sim, leaving->time_in_hive, bee, EVENT_WANT_ENTER) == -1)
+    {
+        return -1;
+    }
+
+    if (sim->waiting_head == -1)
+    {
+        return 0;
+    }
+    int next = sim->waiting_head;
+    sim->waiting_head = sim->bees[next].next_waiting;
+    if (sim->waiting_head == -1)
+    {
+        sim->waiting_tail = -1;
+    }
+    sim->waiting_count--;
+    take_room(sim);
+    return enter(sim, next);
+}
+
+static double seconds_since(const struct timespec *start)
+{
+    struct timespec end;
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    return (end.tv_sec - start->tv_sec) + (end.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int run_hive_simulation(int capacity, long long new_bee_interval, int clutch_size, int gates_number,
+                        const bee_config *bees, int number_of_bees,
+                        bee_config (*hatch)(), long long duration,
+                        simulation_report *report)
+{
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    memset(report, 0, sizeof(*report));
+    simulation sim = {
+        .bee_capacity = number_of_bees + 1,
+        .waiting_head = -1,
+        .waiting_tail = -1,
+        .capacity = capacity,
+        .new_bee_interval = new_bee_interval,
+        .clutch_size = clutch_size > 0 ? clutch_size : 1,
+        .gates_number = gates_number > 0 ? gates_number : 1,
+        .hatch = hatch,
+        .report = report};
+    sim.bees = malloc(sim.bee_capacity * sizeof(simulated_bee));
+    if (sim.bees == NULL)
+    {
+        return -1;
+    }
+
+    int result = 0;
+    sim.bees[QUEEN] = (simulated_bee){.id = 0, .next_waiting = -1};
+    sim.bee_count = 1;
+    sim.next_bee_id = 1;
+    for (int i = 0; i < number_of_bees && result == 0; i++)
+    {
+        int bee = add_bee(&sim, bees[i]);
+        result = schedule_event(&sim, 0, bee, EVENT_WANT_ENTER);
+    }
+    if (result == 0 && new_bee_interval > 0)
+    {
+        result = schedule_event(&sim, new_bee_interval, QUEEN, EVENT_LAY_EGG);
+    }
+
+    long long end = duration;
+    double occupancy_area = 0;
+    while (result == 0 && sim.event_count > 0 && sim.events[0].time <= end)
+    {
+        simulation_event event = pop_event(&sim);
+        occupancy_area += (double)sim.occupancy * (event.time - sim.now);
+        sim.now = event.time;
+        report->events++;
+
+        switch (event.type)
+        {
+        case EVENT_WANT_ENTER:
+        case EVENT_LAY_EGG:
+            result = want_room(&sim, event.bee);
+            break;
+        case EVENT_WANT_LEAVE:
+            result = leave(&sim, event.bee);
+            break;
+        }
+    }
+    occupancy_area += (double)sim.occupancy * (end - sim.now);
+
+    report->mean_occupancy = end > 0 ? occupancy_area / end : sim.occupancy;
+    report->wall_seconds = seconds_since(&start);
+    free(sim.events);
+    free(sim.bees);
+    return result;
+}
@@ -0,0 +1,58 @@
+#ifndef HIVE_SIMULATION_H
+#define HIVE_SIMULATION_H
+
+#include "bee_engine.h"
+#include "hive_ipc.h"
+#include "hive_time.h"
+
+/**
+ * Totals of a simulated run. Occupancy counts bees holding room in the hive,
+ * the same as the occupancy word of the shared memory.
+ */
+typedef struct
+{
+    long long events;
+    long long entries;
+    long long exits;
+    long long births;
+    long long deaths;
+    long long gate_crossings[MAX_GATES];
+    int max_occupancy;
+    double mean_occupancy;              /* averaged over the simulated time */
+    int max_waiting_for_room;
+    double wall_seconds;
+} simulation_report;
+
+/**
+ * Simulates the hive in virtual time, without processes, threads or IPC.
+ *
+ * Every timed step of the bees and the queen is an event in a priority queue
+ * ordered by virtual time. Events are processed one after another and the
+ * clock jumps straight to the next one, so the run takes only as long as the
+ * processing. The rules match the real hive: a bee needs room before it goes
+ * through a gate, stays time_in_hive inside, leaves and spends the same time
+ * outside, and dies after life_span visits. The queen lays a clutch every
+ * new_bee_interval, waits for room for the first egg like the bees do, takes
+ * free room for up to clutch_size eggs and the bees hatch inside. Bees waiting
+ * for room get it in the order they asked. A bee picks its gate as
+ * choose_gate does, but a gate lets it through at once, so no bees queue at
+ * the gates and next_direction never has to choose between directions.
+ *
+ * @param capacity - maximum number of bees in the hive (P)
+ * @param new_bee_interval - time between clutches in ns (T)
+ * @param clutch_size - most eggs laid at once
+ * @param gates_number - number of gates (G)
+ * @param bees - initial bees, all of them start outside
+ * @param number_of_bees - number of initial bees (N)
+ * @param hatch - configuration of a bee born from the queen, its id is set by
+ *        the simulation
+ * @param duration - virtual time to simulate in ns
+ * @param report - filled with the totals of the run
+ * @return int - 0 if the run finished, -1 if there was no memory for it
+ */
+int run_hive_simulation(int capacity, long long new_bee_interval, int clutch_size, int gates_number,
+                        const bee_config *bees, int number_of_bees,
+                        bee_config (*hatch)(), long long duration,
+                        simulation_report *report);
+
+#endif
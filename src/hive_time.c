@@ -0,0 +1,83 @@
+#include "hive_time.h"
+
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+int parse_duration_length(const char *text, size_t length, long long *duration)
+{
+    size_t i = 0;
+    long long value = 0;
+    while (i < length && text[i] >= '0' && text[i] <= '9')
+    {
+        int digit = text[i] - '0';
+        if (value > (LLONG_MAX - digit) / 10)
+        {
+            return -1;
+        }
+        value = value * 10 + digit;
+        i++;
+    }
+    if (i == 0)
+    {
+        return -1;
+    }
+
+    const char *unit = text + i;
+    size_t unit_length = length - i;
+    long long scale;
+    if (unit_length == 0 || (unit_length == 1 && unit[0] == 's'))
+    {
+        scale = NS_PER_SECOND;
+    }
+    else if (unit_length == 2 && unit[1] == 's' && unit[0] == 'm')
+    {
+        scale = NS_PER_MILLISECOND;
+    }
+    else if (unit_length == 2 && unit[1] == 's' && unit[0] == 'u')
+    {
+        scale = NS_PER_MICROSECOND;
+    }
+    else if (unit_length == 2 && unit[1] == 's' && unit[0] == 'n')
+    {
+        scale = 1;
+    }
+    else
+    {
+        return -1;
+    }
+
+    if (value > LLONG_MAX / scale)
+    {
+        return -1;
+    }
+    *duration = value * scale;
+    return 0;
+}
+
+int parse_duration(const char *text, long long *duration)
+{
+    return parse_duration_length(text, strlen(text), duration);
+}
+
+long long monotonic_now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * NS_PER_SECOND + ts.tv_nsec;
+}
+
+int sleep_until(long long deadline)
+{
+    struct timespec ts = {
+        .tv_sec = deadline / NS_PER_SECOND,
+        .tv_nsec = deadline % NS_PER_SECOND};
+    int error = clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    if (error != 0)
+    {
+        errno = error;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,50 @@
+#ifndef HIVE_TIME_H
+#define HIVE_TIME_H
+
+#include <stddef.h>
+
+/**
+ * Durations and deadlines are nanoseconds, deadlines are measured on
+ * CLOCK_MONOTONIC.
+ */
+#define NS_PER_SECOND 1000000000LL
+#define NS_PER_MILLISECOND 1000000LL
+#define NS_PER_MICROSECOND 1000LL
+
+/**
+ * Parses a duration given as a whole number with an optional unit: s, ms, us
+ * or ns. A number without a unit is in seconds, as in the older configs.
+ *
+ * @param text - duration to parse, for example 2, 250ms or 40us
+ * @param duration - parsed duration in nanoseconds
+ * @return int - 0 if the duration is valid, -1 otherwise
+ */
+int parse_duration(const char *text, long long *duration);
+
+/**
+ * Same as parse_duration for text that is not terminated, such as a token of
+ * a memory mapped file.
+ *
+ * @param text - first character of the duration
+ * @param length - number of characters of the duration
+ * @param duration - parsed duration in nanoseconds
+ * @return int - 0 if the duration is valid, -1 otherwise
+ */
+int parse_duration_length(const char *text, size_t length, long long *duration);
+
+/**
+ * @return long long - current time of CLOCK_MONOTONIC in nanoseconds
+ */
+long long monotonic_now();
+
+/**
+ * Sleeps until the deadline with clock_nanosleep, so the time spent between
+ * computing the deadline and falling asleep does not add up over many sleeps.
+ *
+ * @param deadline - time of CLOCK_MONOTONIC in nanoseconds
+ * @return int - 0 when the deadline passed, -1 with errno set to EINTR if a
+ *         signal interrupted the sleep
+ */
+int sleep_until(long long deadline);
+
+#endif
@@ -0,0 +1,437 @@
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "log_format.h"
+
+#define MAX_CONVERSION_SIZE 32
+
+#define LENGTH_NONE 0
+#define LENGTH_CHAR 1
+#define LENGTH_SHORT 2
+#define LENGTH_LONG 3
+#define LENGTH_LONG_LONG 4
+#define LENGTH_INTMAX 5
+#define LENGTH_SIZE 6
+#define LENGTH_PTRDIFF 7
+#define LENGTH_LONG_DOUBLE 8
+
+#define ARGUMENT_NONE 0
+#define ARGUMENT_SIGNED 1
+#define ARGUMENT_UNSIGNED 2
+#define ARGUMENT_DOUBLE 3
+#define ARGUMENT_STRING 4
+#define ARGUMENT_POINTER 5
+#define ARGUMENT_COUNT 6
+#define ARGUMENT_INVALID 7
+
+/**
+ * Single conversion specification of a format, e.g. "%-10s".
+ */
+typedef struct
+{
+    const char *start;
+    int size;
+    int stars;
+    int length;
+    int argument;
+    char specifier;
+} conversion;
+
+/**
+ * Finds the next conversion specification in the format.
+ *
+ * @param format Position in the format to search from.
+ * @param output Parsed conversion.
+ *
+ * @return position right after the conversion or NULL if there is none.
+ */
+static const char *next_conversion(const char *format, conversion *output)
+{
+    const char *start = strchr(format, '%');
+    if (start == NULL)
+    {
+        return NULL;
+    }
+
+    const char *p = start + 1;
+    output->start = start;
+    output->stars = 0;
+    output->length = LENGTH_NONE;
+
+    while (*p && strchr("-+ #0'", *p))
+    {
+        p++;
+    }
+    for (int part = 0; part < 2; part++)
+    {
+        if (part == 1)
+        {
+            if (*p != '.')
+            {
+                break;
+            }
+            p++;
+        }
+        if (*p == '*')
+        {
+            output->stars++;
+            p++;
+        }
+        while (*p >= '0' && *p <= '9')
+        {
+            p++;
+        }
+    }
+
+    switch (*p)
+    {
+    case 'h':
+        output->length = p[1] == 'h' ? LENGTH_CHAR : LENGTH_SHORT;
+        p += p[1] == 'h' ? 2 : 1;
+        break;
+    case 'l':
+        output->length = p[1] == 'l' ? LENGTH_LONG_LONG : LENGTH_LONG;
+        p += p[1] == 'l' ? 2 : 1;
+        break;
+    case 'q':
+        output->length = LENGTH_LONG_LONG;
+        p++;
+        break;
+    case 'j':
+        output->length = LENGTH_INTMAX;
+        p++;
+        break;
+    case 'z':
+        output->length = LENGTH_SIZE;
+        p++;
+        break;
+    case 't':
+        output->length = LENGTH_PTRDIFF;
+        p++;
+        break;
+    case 'L':
+        output->length = LENGTH_LONG_DOUBLE;
+        p++;
+        break;
+    }
+
+    output->specifier = *p;
+    switch (*p)
+    {
+    case 'd':
+    case 'i':
+        output->argument = ARGUMENT_SIGNED;
+        break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+    case 'c':
+        output->argument = ARGUMENT_UNSIGNED;
+        break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        output->argument = ARGUMENT_DOUBLE;
+        break;
+    case 's':
+        output->argument = ARGUMENT_STRING;
+        break;
+    case 'p':
+        output->argument = ARGUMENT_POINTER;
+        break;
+    case 'n':
+        output->argument = ARGUMENT_COUNT;
+        break;
+    case '%':
+        output->argument = ARGUMENT_NONE;
+        break;
+    default:
+        output->argument = ARGUMENT_INVALID;
+        return p;
+    }
+
+    p++;
+    output->size = p - start;
+    if (output->size >= MAX_CONVERSION_SIZE)
+    {
+        output->argument = ARGUMENT_INVALID;
+    }
+    return p;
+}
+
+static int encode_value(uint64_t value, char *buffer, int *used, int size)
+{
+    if (*used + (int)sizeof(value) > size)
+    {
+        return -1;
+    }
+    memcpy(buffer + *used, &value, sizeof(value));
+    *used += sizeof(value);
+    return 0;
+}
+
+static uint64_t decode_value(const char *data, int *position, int length)
+{
+    uint64_t value = 0;
+    if (*position + (int)sizeof(value) <= length)
+    {
+        memcpy(&value, data + *position, sizeof(value));
+    }
+    *position += sizeof(value);
+    return value;
+}
+
+int encode_log_arguments(const char *format, va_list args, char *buffer, int size)
+{
+    conversion conversion;
+    int used = 0;
+    uint64_t value;
+    double floating;
+
+    while ((format = next_conversion(format, &conversion)) != NULL)
+    {
+        if (conversion.argument == ARGUMENT_INVALID)
+        {
+            return -1;
+        }
+        for (int i = 0; i < conversion.stars; i++)
+        {
+            if (encode_value((int64_t)va_arg(args, int), buffer, &used, size) == -1)
+            {
+                return -1;
+            }
+        }
+
+        switch (conversion.argument)
+        {
+        case ARGUMENT_SIGNED:
+        case ARGUMENT_UNSIGNED:
+            switch (conversion.length)
+            {
+            case LENGTH_LONG:
+                value = va_arg(args, long);
+                break;
+            case LENGTH_LONG_LONG:
+                value = va_arg(args, long long);
+                break;
+            case LENGTH_INTMAX:
+                value = va_arg(args, intmax_t);
+                break;
+            case LENGTH_SIZE:
+                value = va_arg(args, size_t);
+                break;
+            case LENGTH_PTRDIFF:
+                value = va_arg(args, ptrdiff_t);
+                break;
+            default:
+                value = conversion.argument == ARGUMENT_SIGNED ? (int64_t)va_arg(args, int) : va_arg(args, unsigned int);
+                break;
+            }
+            // The decoder drops length modifiers, apply their narrowing here.
+            if (conversion.length == LENGTH_CHAR)
+            {
+                value = conversion.argument == ARGUMENT_SIGNED ? (int64_t)(signed char)value : (unsigned char)value;
+            }
+            else if (conversion.length == LENGTH_SHORT)
+            {
+                value = conversion.argument == ARGUMENT_SIGNED ? (int64_t)(short)value : (unsigned short)value;
+            }
+            break;
+        case ARGUMENT_DOUBLE:
+            floating = conversion.length == LENGTH_LONG_DOUBLE ? (double)va_arg(args, long double) : va_arg(args, double);
+            memcpy(&value, &floating, sizeof(value));
+            break;
+        case ARGUMENT_POINTER:
+            value = (uintptr_t)va_arg(args, void *);
+            break;
+        case ARGUMENT_COUNT:
+            va_arg(args, void *);
+            continue;
+        case ARGUMENT_STRING:
+        {
+            const char *string = va_arg(args, const char *);
+            if (string == NULL)
+            {
+                string = "(null)";
+            }
+            uint16_t string_length = strnlen(string, size);
+            if (used + (int)sizeof(string_length) + string_length > size)
+            {
+                return -1;
+            }
+            memcpy(buffer + used, &string_length, sizeof(string_length));
+            memcpy(buffer + used + sizeof(string_length), string, string_length);
+            used += sizeof(string_length) + string_length;
+            continue;
+        }
+        default:
+            continue;
+        }
+
+        if (encode_value(value, buffer, &used, size) == -1)
+        {
+            return -1;
+        }
+    }
+    return used;
+}
+
+int decode_log_arguments(const char *format, const char *data, int length, char *output, int size)
+{
+    conversion conversion;
+    const char *literal = format;
+    int position = 0;
+    int written = 0;
+    int stars[2];
+    char specification[MAX_CONVERSION_SIZE + 2];
+    char string[size];
+
+    output[0] = '\0';
+    while (written < size - 1)
+    {
+        const char *next = next_conversion(literal, &conversion);
+        const char *literal_end = next ? conversion.start : literal + strlen(literal);
+        int literal_size = literal_end - literal;
+        if (literal_size > size - 1 - written)
+        {
+            literal_size = size - 1 - written;
+        }
+        memcpy(output + written, literal, literal_size);
+        written += literal_size;
+        output[written] = '\0';
+        if (next == NULL || conversion.argument == ARGUMENT_INVALID)
+        {
+            break;
+        }
+        literal = next;
+
+        for (int i = 0; i < conversion.stars; i++)
+        {
+            stars[i] = (int)decode_value(data, &position, length);
+        }
+
+        // Length modifiers are dropped, every integer is passed as long long.
+        int specification_size = 0;
+        for (const char *p = conversion.start; p < conversion.start + conversion.size - 1; p++)
+        {
+            if (!strchr("hlqjztL", *p))
+            {
+                specification[specification_size++] = *p;
+            }
+        }
+        if (conversion.argument == ARGUMENT_SIGNED || conversion.argument == ARGUMENT_UNSIGNED)
+        {
+            if (conversion.specifier != 'c')
+            {
+                specification[specification_size++] = 'l';
+                specification[specification_size++] = 'l';
+            }
+        }
+        specification[specification_size++] = conversion.specifier;
+        specification[specification_size] = '\0';
+
+        uint64_t value = 0;
+        double floating;
+        switch (conversion.argument)
+        {
+        case ARGUMENT_STRING:
+        {
+            uint16_t string_length = 0;
+            if (position + (int)sizeof(string_length) <= length)
+            {
+                memcpy(&string_length, data + position, sizeof(string_length));
+            }
+            position += sizeof(string_length);
+            if (position + string_length > length || string_length >= size)
+            {
+                string_length = 0;
+            }
+            memcpy(string, data + position, string_length);
+            string[string_length] = '\0';
+            position += string_length;
+            break;
+        }
+        case ARGUMENT_NONE:
+        case ARGUMENT_COUNT:
+            break;
+        default:
+            value = decode_value(data, &position, length);
+            break;
+        }
+
+        char *destination = output + written;
+        size_t available = size - written;
+        int result = 0;
+#define FORMAT_WITH_STARS(argument)                                                                      \
+    switch (conversion.stars)                                                                            \
+    {                                                                                                    \
+    case 0:                                                                                              \
+        result = snprintf(destination, available, specification, argument);                             \
+        break;                                                                                           \
+    case 1:                                                                                              \
+        result = snprintf(destination, available, specification, stars[0], argument);                   \
+        break;                                                                                           \
+    default:                                                                                             \
+        result = snprintf(destination, available, specification, stars[0], stars[1], argument);         \
+        break;                                                                                           \
+    }
+
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wformat-nonliteral"
+        switch (conversion.argument)
+        {
+        case ARGUMENT_SIGNED:
+            if (conversion.specifier == 'c')
+            {
+                FORMAT_WITH_STARS((int)value);
+            }
+            else
+            {
+                FORMAT_WITH_STARS((long long)value);
+            }
+            break;
+        case ARGUMENT_UNSIGNED:
+            if (conversion.specifier == 'c')
+            {
+                FORMAT_WITH_STARS((int)value);
+            }
+            else
+            {
+                FORMAT_WITH_STARS((unsigned long long)value);
+            }
+            break;
+        case ARGUMENT_DOUBLE:
+            memcpy(&floating, &value, sizeof(floating));
+            FORMAT_WITH_STARS(floating);
+            break;
+        case ARGUMENT_POINTER:
+            FORMAT_WITH_STARS((void *)(uintptr_t)value);
+            break;
+        case ARGUMENT_STRING:
+            FORMAT_WITH_STARS(string);
+            break;
+        case ARGUMENT_NONE:
+            result = snprintf(destination, available, "%%");
+            break;
+        default:
+            break;
+        }
+#pragma GCC diagnostic pop
+#undef FORMAT_WITH_STARS
+
+        if (result < 0)
+        {
+            break;
+        }
+        written += (result < (int)available) ? result : (int)available - 1;
+    }
+    return written;
+}
@@ -0,0 +1,34 @@
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdarg.h>
+
+/**
+ * Encodes the arguments of a printf style format into a compact binary form.
+ * Integers, characters and pointers take 8 bytes, floating point numbers take
+ * 8 bytes and strings are stored as a 2 byte length followed by the characters.
+ *
+ * @param format printf style format the arguments belong to.
+ * @param args Arguments to encode.
+ * @param buffer Destination of the encoded arguments.
+ * @param size Size of the destination.
+ *
+ * @return number of bytes written or -1 if the format uses a conversion that
+ *         can not be encoded or the arguments do not fit.
+ */
+int encode_log_arguments(const char *format, va_list args, char *buffer, int size);
+
+/**
+ * Formats the arguments produced by encode_log_arguments.
+ *
+ * @param format Format the arguments were encoded with.
+ * @param data Encoded arguments.
+ * @param length Number of bytes of encoded arguments.
+ * @param output Destination of the formatted, null terminated message.
+ * @param size Size of the destination.
+ *
+ * @return length of the formatted message.
+ */
+int decode_log_arguments(const char *format, const char *data, int length, char *output, int size);
+
+#endif
@@ -11,52 +11,125 @@
 #include <time.h>
 #include <errno.h>
 #include <stdarg.h>
+#include <stdint.h>
 
 #include "logger_internal.h"
+#include "log_format.h"
 #include "logger.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 
+/**
+ * Level used until the logger is initialized.
+ */
+static _Atomic int default_log_level = LOG_LEVEL_DEBUG;
+_Atomic int *runtime_log_level = &default_log_level;
+
 void init_logger() 
 {
-    allocate();
+    allocate(0, 0);
+    register_producer();
+    runtime_log_level = get_shared_log_level();
     log(LOG_LEVEL_INFO, "LOGGER", "initialized");
 }
 
-void log(int level, char *tag, char *message, ...) 
+#define FORMAT_CACHE_SIZE 64
+
+/**
+ * Per thread cache mapping format string addresses to their ids in the shared
+ * format table, so a format is hashed and looked up only once per thread.
+ *
+ * The address alone does not identify a format, a caller may pass a buffer
+ * whose contents change between calls. A hit is therefore checked against the
+ * text in the shared table, which costs a comparison instead of a hash and a
+ * probe of the table. A cached -1 is never wrong, it only falls back to text.
+ */
+static __thread const char *cached_formats[FORMAT_CACHE_SIZE];
+static __thread int cached_format_ids[FORMAT_CACHE_SIZE];
+
+static int find_format_id(const char *format)
+{
+    int index = ((uintptr_t)format >> 3) % FORMAT_CACHE_SIZE;
+    int format_id = cached_format_ids[index];
+    if (cached_formats[index] == format)
+    {
+        const char *text = lookup_format(format_id);
+        if (format_id == -1 || (text != NULL && strcmp(text, format) == 0))
+        {
+            return format_id;
+        }
+    }
+
+    format_id = register_format(format);
+    cached_format_ids[index] = format_id;
+    cached_formats[index] = format;
+    return format_id;
+}
+
+void log_write(int level, char *tag, char *message, ...) 
 {
     va_list args;
-    va_start(args, message);
-    char buffer[MAX_LOG_MESSAGE_SIZE + 1];
-    buffer[MAX_LOG_MESSAGE_SIZE] = '\0';
-    vsnprintf(buffer, MAX_LOG_MESSAGE_SIZE, message, args);
-    va_end(args);
+    LogMessage log_message;
+    int length = -1;
 
-    char* tag_copy = malloc(strlen(tag) + 1);
-    strcpy(tag_copy, tag);
-    if (strlen(tag) > MAX_TAG_SIZE) 
+    va_start(args, message);
+    log_message.format_id = 0;
+    if (is_binary_mode())
     {
-        tag_copy[MAX_TAG_SIZE] = '\0';
+        int format_id = find_format_id(message);
+        if (format_id != -1)
+        {
+            va_list binary_args;
+            va_copy(binary_args, args);
+            length = encode_log_arguments(message, binary_args, log_message.log_message, MAX_LOG_MESSAGE_SIZE + 1);
+            va_end(binary_args);
+            log_message.format_id = format_id;
+        }
     }
+    if (length == -1)
+    {
+        log_message.kind = LOG_RECORD_TEXT;
+        log_message.log_message[MAX_LOG_MESSAGE_SIZE] = '\0';
+        vsnprintf(log_message.log_message, MAX_LOG_MESSAGE_SIZE, message, args);
+        length = strlen(log_message.log_message) + 1;
+    }
+    else
+    {
+        log_message.kind = LOG_RECORD_BINARY;
+    }
+    va_end(args);
+    log_message.length = length;
+
+    // Tags longer than MAX_TAG_SIZE are cut, the copy never touches the heap.
+    size_t tag_length = strnlen(tag, MAX_TAG_SIZE);
+    memcpy(log_message.log_tag, tag, tag_length);
+    log_message.log_tag[tag_length] = '\0';
 
     struct timespec ts;
     clock_gettime(CLOCK_REALTIME, &ts);
 
-    LogMessage log_message;
     log_message.log_timestamp_s = ts.tv_sec;
     log_message.log_timestamp_ns = ts.tv_nsec;
     log_message.log_level = level;
     log_message.pid = getpid();
-    strcpy(log_message.log_tag, tag_copy);
-    strcpy(log_message.log_message, buffer);
 
     write_log(&log_message);
+}
+
+void set_log_level(int level)
+{
+    atomic_store(runtime_log_level, level);
+}
 
-    free(tag_copy);
+void reinit_logger_after_fork()
+{
+    register_producer();
 }
 
 void close_logger() 
 {
     log(LOG_LEVEL_INFO, "LOGGER", "closing");
+    unregister_producer();
+    runtime_log_level = &default_log_level;
     deallocate_client();
 }
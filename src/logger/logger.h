@@ -7,6 +7,22 @@
 #define LOG_LEVEL_INFO 2
 #define LOG_LEVEL_DEBUG 3
 
+#include <stdatomic.h>
+
+/**
+ * Most verbose level compiled in, calls above it are removed by the compiler.
+ * Set it with make LOG_LEVEL=<level>.
+ */
+#ifndef LOG_LEVEL_COMPILED
+#define LOG_LEVEL_COMPILED LOG_LEVEL_DEBUG
+#endif
+
+/**
+ * Most verbose level logged at runtime. Points into the shared logger memory
+ * once the logger is initialized, so changing it affects all processes.
+ */
+extern _Atomic int *runtime_log_level;
+
 /**
  * Connects the logger client to serer.
  */
@@ -15,12 +31,44 @@ void init_logger();
 /**
  * Logs a message with the given tag and message. 
  * Also accepts infinite number of arguments to be formatted into the message.
+ * Use the log macro instead, it skips messages above the current level
+ * before the arguments are even evaluated.
  * 
  * @param level Log level of the message.
  * @param tag Tag of the message.
  * @param message Message to be logged.
  */
-void log(int level, char *tag, char *message, ...);
+void log_write(int level, char *tag, char *message, ...);
+
+#define log(level, tag, ...)                                                                                \
+    do                                                                                                      \
+    {                                                                                                       \
+        if ((level) <= LOG_LEVEL_COMPILED && (level) <= atomic_load_explicit(runtime_log_level, memory_order_relaxed)) \
+        {                                                                                                   \
+            log_write(level, tag, __VA_ARGS__);                                                             \
+        }                                                                                                   \
+    } while (0)
+
+/**
+ * Changes the runtime log level of all processes connected to the logger.
+ *
+ * @param level One of the LOG_LEVEL_ values.
+ */
+void set_log_level(int level);
+
+/**
+ * Parses a log level given as a name (none, error, info, debug) or a number.
+ *
+ * @return the level or -1 if it is invalid.
+ */
+int parse_log_level(const char *name);
+
+/**
+ * Gives a process forked from a logger client its own drop counters, the
+ * mapping of the shared memory is inherited. Should be used in the child
+ * right after fork.
+ */
+void reinit_logger_after_fork();
 
 /**
  * Cleans up the logger for the client process.
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <sys/mman.h>
 #include <fcntl.h>
 #include <stdlib.h>
@@ -6,50 +8,145 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
+#include <sched.h>
+#include <stddef.h>
+#include <signal.h>
+#include <limits.h>
 
 #include "logger_internal.h"
+#include "logger.h"
+#include "../futex.h"
 
 #define SHARED_MEMORY_NAME "/myshm"
 #define SEMAPHORE_WRITE "/semaphore_write"
-#define SEMAPHORE_READ "/semaphore_read"
-#define WRITE_SEMAPHORE_FULL "write_semaphore_full"
 
+/**
+ * Guards the creation and initialization of the shared memory segment only,
+ * it is never taken on the logging path.
+ */
 sem_t *write_semaphore;
-sem_t *read_semaphore;
-sem_t *write_semaphore_full;
-void *header;
+Header *header;
 int shmfd;
 
-#define MAX_LOGS 100
-#define MEMORY_SIZE MAX_LOGS * sizeof(LogMessage) + sizeof(Header)
+/**
+ * Drop counters of this process.
+ */
+ProducerEntry *producer;
+
+size_t memory_size;
 
-void allocate()
+/**
+ * @return name of the shared memory segment of the logger.
+ */
+static const char *shared_memory_name()
 {
-    write_semaphore = sem_open(SEMAPHORE_WRITE, O_CREAT, 0644, 1);
-    write_semaphore_full = sem_open(WRITE_SEMAPHORE_FULL, O_CREAT, 0644, MAX_LOGS);
-    if (write_semaphore == SEM_FAILED)
+    const char *name = getenv(LOGGER_SHM_VARIABLE);
+    return name != NULL && name[0] == '/' ? name : SHARED_MEMORY_NAME;
+}
+
+/**
+ * @return name of the semaphore guarding the creation of the segment.
+ */
+static const char *semaphore_name(char *buffer, size_t size)
+{
+    const char *name = shared_memory_name();
+    if (strcmp(name, SHARED_MEMORY_NAME) == 0)
     {
-        perror("sem_open write_semaphore");
-        deallocate_client();
-        return;
+        return SEMAPHORE_WRITE;
+    }
+    snprintf(buffer, size, "%s_write", name);
+    return buffer;
+}
+
+#define align_record(size) (((size) + RECORD_ALIGNMENT - 1) & ~(uint32_t)(RECORD_ALIGNMENT - 1))
+
+uint32_t parse_ring_size(const char *text)
+{
+    char *endptr;
+    errno = 0;
+    unsigned long long size = strtoull(text, &endptr, 10);
+    if (*endptr == 'K' || *endptr == 'k')
+    {
+        size <<= 10;
+        endptr++;
+    }
+    else if (*endptr == 'M' || *endptr == 'm')
+    {
+        size <<= 20;
+        endptr++;
+    }
+    if (errno == ERANGE || *endptr != '\0' || size == 0 || size > MAX_RING_SIZE)
+    {
+        return 0;
+    }
+
+    uint32_t ring_size = MIN_RING_SIZE;
+    while (ring_size < size)
+    {
+        ring_size <<= 1;
+    }
+    return ring_size;
+}
+
+/**
+ * @return number of rings to create when the caller did not choose one.
+ */
+static uint32_t default_ring_count()
+{
+    char *variable = getenv(RING_COUNT_VARIABLE);
+    if (variable != NULL)
+    {
+        char *endptr;
+        long count = strtol(variable, &endptr, 10);
+        if (*variable != '\0' && *endptr == '\0' && count > 0 && count <= MAX_RINGS)
+        {
+            return count;
+        }
+        fprintf(stderr, "Invalid %s, using one ring per CPU\n", RING_COUNT_VARIABLE);
     }
 
-    read_semaphore = sem_open(SEMAPHORE_READ, O_CREAT, 0644, 0);
-    if (read_semaphore == SEM_FAILED)
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (cpus < 1)
     {
-        perror("sem_open read_semaphore");
+        return 1;
+    }
+    return cpus > MAX_RINGS ? MAX_RINGS : cpus;
+}
+
+void allocate(uint32_t ring_size, uint32_t ring_count)
+{
+    if (ring_size == 0)
+    {
+        char *variable = getenv(RING_SIZE_VARIABLE);
+        ring_size = variable ? parse_ring_size(variable) : DEFAULT_RING_SIZE;
+        if (ring_size == 0)
+        {
+            fprintf(stderr, "Invalid %s, using %d bytes\n", RING_SIZE_VARIABLE, DEFAULT_RING_SIZE);
+            ring_size = DEFAULT_RING_SIZE;
+        }
+    }
+    if (ring_count == 0)
+    {
+        ring_count = default_ring_count();
+    }
+
+    char semaphore_buffer[NAME_MAX];
+    write_semaphore = sem_open(semaphore_name(semaphore_buffer, sizeof(semaphore_buffer)), O_CREAT, 0644, 1);
+    if (write_semaphore == SEM_FAILED)
+    {
+        perror("sem_open write_semaphore");
         deallocate_client();
         return;
     }
 
     sem_wait(write_semaphore);
 
-    shmfd = shm_open(SHARED_MEMORY_NAME, O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
+    shmfd = shm_open(shared_memory_name(), O_CREAT | O_EXCL | O_RDWR, S_IRUSR | S_IWUSR);
     if (shmfd == -1)
     {
         if (errno == EEXIST)
         {
-            shmfd = shm_open(SHARED_MEMORY_NAME, O_RDWR, S_IRUSR | S_IWUSR);
+            shmfd = shm_open(shared_memory_name(), O_RDWR, S_IRUSR | S_IWUSR);
             if (shmfd == -1)
             {
                 perror("shm_open");
@@ -57,7 +154,17 @@ void allocate()
                 return;
             }
 
-            header = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
+            // The ring size and count are decided by the creator, read them from the header first.
+            header = mmap(NULL, sizeof(Header), PROT_READ, MAP_SHARED, shmfd, 0);
+            if (header == MAP_FAILED)
+            {
+                perror("mmap");
+                sem_post(write_semaphore);
+                return;
+            }
+            memory_size = sizeof(Header) + (size_t)header->ring_size * header->ring_count;
+            munmap(header, sizeof(Header));
+            header = mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
         }
         else
         {
@@ -66,66 +173,576 @@ void allocate()
     }
     else
     {
-        ftruncate(shmfd, MEMORY_SIZE);
-        header = mmap(NULL, MEMORY_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
+        memory_size = sizeof(Header) + (size_t)ring_size * ring_count;
+        ftruncate(shmfd, memory_size);
+        header = mmap(NULL, memory_size, PROT_READ | PROT_WRITE, MAP_SHARED, shmfd, 0);
 
-        if (header == NULL) 
+        if (header == MAP_FAILED)
         {
             perror("mmap");
             deallocate_server();
             return;
         }
-        ((Header*)header)->write = sizeof(Header);
-        ((Header*)header)->read = sizeof(Header);
+        atomic_init(&header->reader_sleeping, 0);
+        atomic_init(&header->binary, 0);
+        atomic_init(&header->policy, POLICY_BLOCK);
+        atomic_init(&header->log_level, LOG_LEVEL_DEBUG);
+        header->ring_size = ring_size;
+        header->ring_count = ring_count;
+        for (int i = 0; i < MAX_RINGS; i++)
+        {
+            atomic_init(&header->rings[i].write, 0);
+            atomic_init(&header->rings[i].read, 0);
+            atomic_init(&header->rings[i].released, 0);
+            atomic_init(&header->rings[i].writers_sleeping, 0);
+        }
+        for (int i = 0; i < MAX_FORMATS; i++)
+        {
+            atomic_init(&header->formats[i].state, FORMAT_FREE);
+        }
+        for (int i = 0; i < MAX_PRODUCERS; i++)
+        {
+            atomic_init(&header->producers[i].state, PRODUCER_FREE);
+        }
+        atomic_init(&header->producers[MAX_PRODUCERS].state, PRODUCER_ACTIVE);
     }
 
     sem_post(write_semaphore);
 }
 
+uint32_t get_ring_size()
+{
+    return header->ring_size;
+}
+
+uint32_t get_ring_count()
+{
+    return header->ring_count;
+}
+
+int is_binary_mode()
+{
+    return atomic_load_explicit(&header->binary, memory_order_relaxed);
+}
+
+void set_binary_mode(int binary)
+{
+    atomic_store(&header->binary, binary ? 1 : 0);
+}
+
+_Atomic int *get_shared_log_level()
+{
+    return &header->log_level;
+}
+
+int parse_log_level(const char *name)
+{
+    static const char *names[] = {"none", "error", "info", "debug"};
+    for (int level = LOG_LEVEL_NONE; level <= LOG_LEVEL_DEBUG; level++)
+    {
+        if (strcmp(name, names[level]) == 0)
+        {
+            return level;
+        }
+    }
+
+    char *endptr;
+    long level = strtol(name, &endptr, 10);
+    if (*name == '\0' || *endptr != '\0' || level < LOG_LEVEL_NONE || level > LOG_LEVEL_DEBUG)
+    {
+        return -1;
+    }
+    return level;
+}
+
+void set_overflow_policy(int policy)
+{
+    atomic_store(&header->policy, policy);
+}
+
+int parse_overflow_policy(const char *name)
+{
+    if (strcmp(name, "block") == 0)
+    {
+        return POLICY_BLOCK;
+    }
+    if (strcmp(name, "drop") == 0)
+    {
+        return POLICY_DROP_NEWEST;
+    }
+    if (strcmp(name, "overwrite") == 0)
+    {
+        return POLICY_OVERWRITE_OLDEST;
+    }
+    return -1;
+}
+
+void register_producer()
+{
+    for (int i = 0; i < MAX_PRODUCERS; i++)
+    {
+        ProducerEntry *entry = &header->producers[i];
+        uint32_t state = PRODUCER_FREE;
+        if (atomic_load_explicit(&entry->state, memory_order_relaxed) == PRODUCER_FREE &&
+            atomic_compare_exchange_strong(&entry->state, &state, PRODUCER_ACTIVE))
+        {
+            atomic_store(&entry->pid, getpid());
+            producer = entry;
+            return;
+        }
+    }
+    producer = &header->producers[MAX_PRODUCERS];
+}
+
+void unregister_producer()
+{
+    if (producer != NULL && producer != &header->producers[MAX_PRODUCERS])
+    {
+        atomic_store(&producer->state, PRODUCER_CLOSED);
+    }
+    producer = NULL;
+}
+
+/**
+ * @return drop counters of this process, the shared ones if it has none.
+ */
+static ProducerEntry *own_producer()
+{
+    return producer != NULL ? producer : &header->producers[MAX_PRODUCERS];
+}
+
+ProducerEntry *get_producer(int index)
+{
+    return &header->producers[index];
+}
+
+void free_producer(ProducerEntry *entry)
+{
+    atomic_store(&entry->pid, 0);
+    atomic_store(&entry->dropped, 0);
+    atomic_store(&entry->overwritten, 0);
+    entry->reported_dropped = 0;
+    entry->reported_overwritten = 0;
+    atomic_store(&entry->state, PRODUCER_FREE);
+}
+
+static uint32_t hash_format(const char *format)
+{
+    uint32_t hash = 2166136261u;
+    while (*format)
+    {
+        hash = (hash ^ (unsigned char)*format++) * 16777619u;
+    }
+    return hash;
+}
+
+int register_format(const char *format)
+{
+    size_t length = strlen(format);
+    if (length >= MAX_FORMAT_SIZE)
+    {
+        return -1;
+    }
+
+    uint32_t hash = hash_format(format);
+    for (uint32_t i = 0; i < MAX_FORMATS; i++)
+    {
+        int format_id = (hash + i) % MAX_FORMATS;
+        FormatEntry *entry = &header->formats[format_id];
+        uint32_t state = atomic_load_explicit(&entry->state, memory_order_acquire);
+        if (state == FORMAT_FREE)
+        {
+            if (atomic_compare_exchange_strong(&entry->state, &state, FORMAT_WRITING))
+            {
+                entry->hash = hash;
+                memcpy(entry->text, format, length + 1);
+                atomic_store_explicit(&entry->state, FORMAT_READY, memory_order_release);
+                return format_id;
+            }
+        }
+        while (state == FORMAT_WRITING)
+        {
+            sched_yield();
+            state = atomic_load_explicit(&entry->state, memory_order_acquire);
+        }
+        if (entry->hash == hash && strcmp(entry->text, format) == 0)
+        {
+            return format_id;
+        }
+    }
+    return -1;
+}
+
+const char *lookup_format(int format_id)
+{
+    if (format_id < 0 || format_id >= MAX_FORMATS)
+    {
+        return NULL;
+    }
+    FormatEntry *entry = &header->formats[format_id];
+    if (atomic_load_explicit(&entry->state, memory_order_acquire) != FORMAT_READY)
+    {
+        return NULL;
+    }
+    return entry->text;
+}
+
+/**
+ * @return record at the position of the ring.
+ */
+static LogRecord *ring_record(Ring *ring, uint32_t position)
+{
+    unsigned char *data = header->data + (size_t)(ring - header->rings) * header->ring_size;
+    return (LogRecord *)(data + (position & (header->ring_size - 1)));
+}
+
+/**
+ * @return ring of the CPU the caller runs on.
+ */
+static Ring *own_ring()
+{
+    int cpu = sched_getcpu();
+    if (cpu < 0)
+    {
+        cpu = getpid();
+    }
+    return &header->rings[cpu % header->ring_count];
+}
+
+/**
+ * Zeroes a claimed record and hands its space back to the producers. Space is
+ * released in ring order, so this waits for earlier claimers to finish first.
+ */
+static void release_record(Ring *ring, LogRecord *record, uint32_t read, uint32_t size)
+{
+    memset(record, 0, size);
+    while (atomic_load(&ring->released) != read)
+    {
+        sched_yield();
+    }
+    atomic_store(&ring->released, read + size);
+    if (atomic_load(&ring->writers_sleeping))
+    {
+        futex_wake(&ring->released, INT_MAX);
+    }
+}
+
+/**
+ * Claims the oldest record of the ring and throws it away to make room for a
+ * new one.
+ *
+ * @return 0 if the caller should retry its reservation, -1 if the oldest
+ *         record is still being written and can not be discarded.
+ */
+static int discard_oldest_record(Ring *ring)
+{
+    uint32_t read = atomic_load(&ring->read);
+    if (read == atomic_load(&ring->write))
+    {
+        // Everything is claimed already, the space comes back once it is released.
+        sched_yield();
+        return 0;
+    }
+
+    LogRecord *record = ring_record(ring, read);
+    uint32_t size = atomic_load_explicit(&record->size, memory_order_acquire);
+    if (size == 0 || (size & RECORD_PENDING))
+    {
+        return -1;
+    }
+    if (!atomic_compare_exchange_strong(&ring->read, &read, read + size))
+    {
+        return 0;
+    }
+
+    if (record->kind != LOG_RECORD_PADDING)
+    {
+        atomic_fetch_add_explicit(&own_producer()->overwritten, 1, memory_order_relaxed);
+    }
+    release_record(ring, record, read, size);
+    return 0;
+}
+
+/**
+ * Writes the message into the ring, applying the overflow policy if it is
+ * full.
+ */
+static void write_record(Ring *ring, LogMessage *log_message)
+{
+    uint32_t ring_size = header->ring_size;
+    uint32_t size = align_record(sizeof(LogRecord) + log_message->length + strlen(log_message->log_tag));
+    uint32_t write = atomic_load(&ring->write);
+    uint32_t offset;
+    uint32_t padding;
+
+    for (;;)
+    {
+        // A record never wraps around, the rest of the ring is filled with padding instead.
+        offset = write & (ring_size - 1);
+        padding = offset + size > ring_size ? ring_size - offset : 0;
+
+        uint32_t released = atomic_load(&ring->released);
+        if (write + padding + size - released > ring_size)
+        {
+            switch (atomic_load_explicit(&header->policy, memory_order_relaxed))
+            {
+            case POLICY_DROP_NEWEST:
+                atomic_fetch_add_explicit(&own_producer()->dropped, 1, memory_order_relaxed);
+                return;
+            case POLICY_OVERWRITE_OLDEST:
+                if (discard_oldest_record(ring) == -1)
+                {
+                    atomic_fetch_add_explicit(&own_producer()->dropped, 1, memory_order_relaxed);
+                    return;
+                }
+                break;
+            default:
+                // Wait for the server to consume some records.
+                atomic_fetch_add(&ring->writers_sleeping, 1);
+                if (atomic_load(&ring->released) == released)
+                {
+                    futex_wait(&ring->released, released, NULL);
+                }
+                atomic_fetch_sub(&ring->writers_sleeping, 1);
+                break;
+            }
+            write = atomic_load(&ring->write);
+            continue;
+        }
+
+        if (atomic_compare_exchange_weak(&ring->write, &write, write + padding + size))
+        {
+            break;
+        }
+    }
+
+    if (padding)
+    {
+        LogRecord *padding_record = ring_record(ring, write);
+        padding_record->kind = LOG_RECORD_PADDING;
+        atomic_store_explicit(&padding_record->size, padding, memory_order_release);
+    }
+
+    // Lets the server tell a slow producer from a dead one.
+    LogRecord *record = ring_record(ring, write + padding);
+    record->pid = log_message->pid;
+    atomic_store_explicit(&record->size, size | RECORD_PENDING, memory_order_release);
+
+    record->kind = log_message->kind;
+    record->format_id = log_message->format_id;
+    record->log_timestamp_s = log_message->log_timestamp_s;
+    record->log_timestamp_ns = log_message->log_timestamp_ns;
+    record->log_level = log_message->log_level;
+    record->tag_length = strlen(log_message->log_tag);
+    record->length = log_message->length;
+    memcpy(record->data, log_message->log_tag, record->tag_length);
+    memcpy(record->data + record->tag_length, log_message->log_message, log_message->length);
+    atomic_store(&record->size, size);
+
+    // Only the producer that finds the server asleep pays for the wake up.
+    if (atomic_load(&header->reader_sleeping) && atomic_exchange(&header->reader_sleeping, 0))
+    {
+        futex_wake(&header->reader_sleeping, 1);
+    }
+}
+
 void write_log(LogMessage *log_message)
 {
-    sem_wait(write_semaphore_full);
-    sem_wait(write_semaphore);
-    LogMessage* write_pointer = ((char*)header + ((Header*)header)->write);
-    memcpy(write_pointer, log_message, sizeof(LogMessage));
-    ((Header*)header)->write += sizeof(LogMessage);
-    if (((Header*)header)->write == MEMORY_SIZE)
+    write_record(own_ring(), log_message);
+}
+
+/**
+ * Claims and throws away a record that its producer reserved but will never
+ * publish because it is gone.
+ *
+ * @return 1 if the record was skipped, 0 if the producer is still alive or
+ *         the record changed in the meantime.
+ */
+static int skip_abandoned_record(Ring *ring, LogRecord *record, uint32_t read, uint32_t size)
+{
+    int pid = record->pid;
+    if (kill(pid, 0) == 0 || errno != ESRCH)
     {
-        ((Header*)header)->write = sizeof(Header);
+        return 0;
+    }
+    if (atomic_load_explicit(&record->size, memory_order_acquire) != size ||
+        !atomic_compare_exchange_strong(&ring->read, &read, read + (size & ~RECORD_PENDING)))
+    {
+        return 0;
+    }
+    fprintf(stderr, "Skipped a record of producer %d which exited before publishing it\n", pid);
+    release_record(ring, record, read, size & ~RECORD_PENDING);
+    return 1;
+}
+
+/**
+ * Takes the oldest record out of a single ring without waiting.
+ *
+ * @return 1 if a message was copied, 0 if the ring is empty.
+ */
+static int take_record(Ring *ring, LogMessage *log_message)
+{
+    int spins = 0;
+
+    for (;;)
+    {
+        uint32_t read = atomic_load(&ring->read);
+        LogRecord *record = ring_record(ring, read);
+        uint32_t size = atomic_load_explicit(&record->size, memory_order_acquire);
+        if (size == 0 || (size & RECORD_PENDING))
+        {
+            if (size == 0 && atomic_load(&ring->write) == read)
+            {
+                return 0;
+            }
+            // A producer reserved the space but has not published the record yet. Once it
+            // marked the record pending it can be skipped if the producer died, a producer
+            // killed between reserving and marking still stalls the ring.
+            if ((size & RECORD_PENDING) && ++spins >= PENDING_RECORD_SPINS)
+            {
+                spins = 0;
+                skip_abandoned_record(ring, record, read, size);
+                continue;
+            }
+            sched_yield();
+            continue;
+        }
+        spins = 0;
+
+        // Claim the record first, a producer may be overwriting it.
+        if (!atomic_compare_exchange_strong(&ring->read, &read, read + size))
+        {
+            continue;
+        }
+        if (record->kind == LOG_RECORD_PADDING)
+        {
+            release_record(ring, record, read, size);
+            continue;
+        }
+
+        log_message->kind = record->kind;
+        log_message->format_id = record->format_id;
+        log_message->log_timestamp_s = record->log_timestamp_s;
+        log_message->log_timestamp_ns = record->log_timestamp_ns;
+        log_message->pid = record->pid;
+        log_message->log_level = record->log_level;
+        log_message->length = record->length;
+        memcpy(log_message->log_tag, record->data, record->tag_length);
+        log_message->log_tag[record->tag_length] = '\0';
+        memcpy(log_message->log_message, record->data + record->tag_length, record->length);
+
+        release_record(ring, record, read, size);
+        return 1;
     }
-    sem_post(read_semaphore);
-    sem_post(write_semaphore);
 }
 
-LogMessage *read_log()
-{   
-    sem_wait(read_semaphore);
-    LogMessage *log_message = malloc(sizeof(LogMessage));
-    LogMessage* read_pointer = ((char*)header + ((Header*)header)->read);
-    memcpy(log_message, read_pointer, sizeof(LogMessage));
-    ((Header*)header)->read += sizeof(LogMessage);
-    if (((Header*)header)->read == MEMORY_SIZE)
+/**
+ * @return 1 if no ring holds a reserved or published record.
+ */
+static int rings_empty()
+{
+    for (uint32_t i = 0; i < header->ring_count; i++)
     {
-        ((Header*)header)->read = sizeof(Header);
+        if (atomic_load(&header->rings[i].write) != atomic_load(&header->rings[i].read))
+        {
+            return 0;
+        }
     }
-    sem_post(write_semaphore_full);
-    return log_message;
+    return 1;
+}
+
+/**
+ * Oldest message taken out of each ring but not returned yet. The reader
+ * keeps one message per ring so that it can return the oldest of them.
+ */
+static LogMessage *pending_messages;
+static uint8_t pending[MAX_RINGS];
+static int pending_count;
+
+int read_log(LogMessage *log_message, int timeout_ms)
+{
+    struct timespec timeout = {
+        .tv_sec = timeout_ms / 1000,
+        .tv_nsec = (timeout_ms % 1000) * 1000000L};
+    uint32_t ring_count = header->ring_count;
+
+    if (pending_messages == NULL)
+    {
+        pending_messages = malloc(sizeof(LogMessage) * ring_count);
+        if (pending_messages == NULL)
+        {
+            perror("malloc");
+            return 0;
+        }
+    }
+
+    for (;;)
+    {
+        for (uint32_t i = 0; i < ring_count; i++)
+        {
+            if (!pending[i] && take_record(&header->rings[i], &pending_messages[i]))
+            {
+                pending[i] = 1;
+                pending_count++;
+            }
+        }
+        if (pending_count > 0)
+        {
+            break;
+        }
+        if (timeout_ms == 0)
+        {
+            return 0;
+        }
+
+        atomic_store(&header->reader_sleeping, 1);
+        if (!rings_empty())
+        {
+            atomic_store(&header->reader_sleeping, 0);
+            continue;
+        }
+        if (futex_wait(&header->reader_sleeping, 1, &timeout) == -1 && errno != EAGAIN)
+        {
+            atomic_store(&header->reader_sleeping, 0);
+            return 0;
+        }
+    }
+
+    int oldest = -1;
+    for (uint32_t i = 0; i < ring_count; i++)
+    {
+        if (!pending[i])
+        {
+            continue;
+        }
+        if (oldest == -1 ||
+            pending_messages[i].log_timestamp_s < pending_messages[oldest].log_timestamp_s ||
+            (pending_messages[i].log_timestamp_s == pending_messages[oldest].log_timestamp_s &&
+             pending_messages[i].log_timestamp_ns < pending_messages[oldest].log_timestamp_ns))
+        {
+            oldest = i;
+        }
+    }
+
+    LogMessage *message = &pending_messages[oldest];
+    memcpy(log_message, message, offsetof(LogMessage, log_message));
+    memcpy(log_message->log_message, message->log_message, message->length);
+    pending[oldest] = 0;
+    pending_count--;
+    return 1;
 }
 
 void deallocate_client()
 {
     sem_close(write_semaphore);
-    sem_close(read_semaphore);
-    sem_close(write_semaphore_full);
 
-    munmap(header, MEMORY_SIZE);
+    munmap(header, memory_size);
     close(shmfd);
  }
 
-void deallocate_server() 
+void deallocate_server()
 {
-    sem_unlink(SEMAPHORE_WRITE);
-    sem_unlink(SEMAPHORE_READ);
-    sem_unlink(WRITE_SEMAPHORE_FULL);
-    shm_unlink(SHARED_MEMORY_NAME);
+    char semaphore_buffer[NAME_MAX];
+    sem_unlink(semaphore_name(semaphore_buffer, sizeof(semaphore_buffer)));
+    shm_unlink(shared_memory_name());
 }
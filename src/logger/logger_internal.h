@@ -1,27 +1,290 @@
+#include <stdint.h>
+#include <stdatomic.h>
 
-#define MAX_LOG_MESSAGE_SIZE 120
+#define MAX_LOG_MESSAGE_SIZE 1024
 #define MAX_TAG_SIZE 10
 
+/**
+ * Size of each ring in bytes when neither logger_server -s nor the
+ * LOGGER_RING_SIZE environment variable set it. The size is always rounded
+ * up to a power of two so that offsets stay consistent when the 32-bit
+ * positions wrap around.
+ */
+#define DEFAULT_RING_SIZE (1 << 18)
+#define MIN_RING_SIZE (1 << 12)
+#define MAX_RING_SIZE (1 << 30)
+#define RING_SIZE_VARIABLE "LOGGER_RING_SIZE"
+
+/**
+ * Name of the shared memory segment of the logger, "/myshm" unless the
+ * LOGGER_SHM environment variable names another one starting with a slash.
+ * The server and its producers must agree on it, children inherit it.
+ */
+#define LOGGER_SHM_VARIABLE "LOGGER_SHM"
+
+/**
+ * Producers write to the ring of the CPU they run on. Without logger_server -c
+ * or the LOGGER_RINGS environment variable there is one ring per online CPU.
+ */
+#define MAX_RINGS 256
+#define RING_COUNT_VARIABLE "LOGGER_RINGS"
+
+#define CACHE_LINE_SIZE 64
+#define RECORD_ALIGNMENT 8
+
+/**
+ * Size of the table of format strings shared by all producers in binary mode.
+ */
+#define MAX_FORMATS 256
+#define MAX_FORMAT_SIZE 128
+
+/**
+ * Flag in the size of a record whose space is reserved but whose contents are
+ * not written yet. Ring sizes stay below 2^31, so it never clashes with a size.
+ */
+#define RECORD_PENDING 0x80000000u
+
+/**
+ * Number of times the server yields on a pending record before it checks
+ * whether the producer that reserved it is still alive.
+ */
+#define PENDING_RECORD_SPINS 1024
+
+#define LOG_RECORD_TEXT 0
+#define LOG_RECORD_BINARY 1
+#define LOG_RECORD_PADDING 2
+
+#define FORMAT_FREE 0
+#define FORMAT_WRITING 1
+#define FORMAT_READY 2
+
+/**
+ * What a producer does when the ring has no room for its record.
+ * POLICY_BLOCK waits for the server, POLICY_DROP_NEWEST discards the new
+ * record and POLICY_OVERWRITE_OLDEST discards the oldest unread records.
+ */
+#define POLICY_BLOCK 0
+#define POLICY_DROP_NEWEST 1
+#define POLICY_OVERWRITE_OLDEST 2
+
+/**
+ * Number of producer processes with their own drop counters, the rest share
+ * one additional entry.
+ */
+#define MAX_PRODUCERS 1024
+
+#define PRODUCER_FREE 0
+#define PRODUCER_ACTIVE 1
+#define PRODUCER_CLOSED 2
+
+/**
+ * Single log message as seen by the producers and the server. A text message
+ * carries the formatted message, a binary message carries the id of its format
+ * string and the raw arguments encoded by encode_log_arguments, formatting is
+ * left to the server.
+ */
 typedef struct {
     int log_timestamp_s;
     int log_timestamp_ns;
     int log_level;
     int pid;
     char log_tag[MAX_TAG_SIZE + 1];
+    uint8_t kind;
+    uint16_t format_id;
+    uint16_t length;                                /* bytes used in log_message */
     char log_message[MAX_LOG_MESSAGE_SIZE + 1];
 } LogMessage;
 
+/**
+ * Length prefixed record stored in the ring, followed by the tag and the
+ * message. Only the bytes actually used are stored and every record starts
+ * at a multiple of RECORD_ALIGNMENT.
+ *
+ * The size is written last and doubles as the commit flag: the server treats
+ * a record with size 0 or with RECORD_PENDING set as not yet published. Right
+ * after reserving the space the producer stores its pid and the size with
+ * RECORD_PENDING, so that the server can skip the record if the producer dies
+ * before publishing it. A padding record fills the end of the ring when the
+ * next record would not fit before wrapping around.
+ */
+typedef struct {
+    _Atomic uint32_t size;
+    uint16_t kind;
+    uint16_t format_id;
+    int log_timestamp_s;
+    int log_timestamp_ns;
+    int pid;
+    uint8_t log_level;
+    uint8_t tag_length;
+    uint16_t length;
+    char data[];
+} LogRecord;
+
+/**
+ * Entry of the shared format table. Producers claim a free entry with a
+ * compare-and-swap, copy the format and mark it ready, the server only reads
+ * ready entries.
+ */
+typedef struct {
+    _Atomic uint32_t state;
+    uint32_t hash;
+    char text[MAX_FORMAT_SIZE];
+} FormatEntry;
+
+/**
+ * Drop counters of a single producer process. The reported counts are only
+ * used by the server to print what changed since the last report.
+ */
 typedef struct {
-    int write;
-    int read;
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t state;
+    _Atomic int pid;
+    _Atomic uint64_t dropped;       /* own records discarded because the ring was full */
+    _Atomic uint64_t overwritten;   /* oldest records discarded to make room */
+    uint64_t reported_dropped;
+    uint64_t reported_overwritten;
+} ProducerEntry;
+
+/**
+ * Positions of a single ring.
+ *
+ * Positions are byte offsets that only grow and are taken modulo the ring
+ * size. Producers reserve space by moving write with a compare-and-swap.
+ * Records are claimed by moving read with a compare-and-swap, by the server
+ * to consume them or by a producer overwriting the oldest records. The
+ * claimer zeroes the record and moves released past it in order, which hands
+ * the space back to producers. Free space is always zeroed so that an
+ * unpublished record reads as size 0. The producer and consumer positions
+ * live on separate cache lines.
+ */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t write;   /* end of the reserved space */
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t read;    /* start of the unclaimed records */
+    _Atomic uint32_t released;                          /* start of the space in use, futex word for producers on a full ring */
+    _Atomic uint32_t writers_sleeping;                  /* number of producers waiting for free space */
+} Ring;
+
+/**
+ * Layout of the shared memory segment, the data of ring_count rings of
+ * ring_size bytes each follows the header.
+ */
+typedef struct {
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint32_t reader_sleeping; /* futex word, 1 while the server waits on empty rings */
+    _Alignas(CACHE_LINE_SIZE) uint32_t ring_size;
+    uint32_t ring_count;
+    _Atomic uint32_t binary;                            /* 1 when producers should send binary records */
+    _Atomic uint32_t policy;                            /* one of the POLICY_ values */
+    _Atomic int log_level;                              /* most verbose level producers send */
+    FormatEntry formats[MAX_FORMATS];
+    ProducerEntry producers[MAX_PRODUCERS + 1];
+    Ring rings[MAX_RINGS];
+    _Alignas(CACHE_LINE_SIZE) unsigned char data[];
 } Header;
 
-void allocate();
+/**
+ * Parses a ring size given in bytes with an optional K or M suffix.
+ *
+ * @return size rounded up to a power of two or 0 if it is invalid.
+ */
+uint32_t parse_ring_size(const char *text);
+
+/**
+ * Maps the shared memory segment, creating it if it does not exist yet.
+ *
+ * @param ring_size Size of each ring used when the segment is created, 0
+ *        takes it from the LOGGER_RING_SIZE environment variable or the default.
+ * @param ring_count Number of rings used when the segment is created, 0 takes
+ *        it from the LOGGER_RINGS environment variable or the CPU count.
+ */
+void allocate(uint32_t ring_size, uint32_t ring_count);
+
+/**
+ * @return size of each ring of the mapped segment.
+ */
+uint32_t get_ring_size();
+
+/**
+ * @return number of rings of the mapped segment.
+ */
+uint32_t get_ring_count();
+
+/**
+ * @return 1 if producers should send binary records, 0 otherwise.
+ */
+int is_binary_mode();
+
+/**
+ * Switches all producers between text and binary records.
+ */
+void set_binary_mode(int binary);
+
+/**
+ * @return runtime log level stored in the shared memory.
+ */
+_Atomic int *get_shared_log_level();
+
+/**
+ * Sets what producers do when the ring is full.
+ */
+void set_overflow_policy(int policy);
+
+/**
+ * Parses the name of an overflow policy: block, drop or overwrite.
+ *
+ * @return one of the POLICY_ values or -1 if the name is unknown.
+ */
+int parse_overflow_policy(const char *name);
+
+/**
+ * Assigns drop counters to the calling process.
+ */
+void register_producer();
+
+/**
+ * Marks the drop counters of the calling process as no longer in use, the
+ * server frees them after reporting.
+ */
+void unregister_producer();
+
+/**
+ * @return drop counters at the index, MAX_PRODUCERS is the entry shared by
+ *         processes that did not get their own.
+ */
+ProducerEntry *get_producer(int index);
+
+/**
+ * Clears the drop counters and makes them available to a new producer.
+ */
+void free_producer(ProducerEntry *entry);
+
+/**
+ * Finds the format in the shared table, adding it if it is not there yet.
+ *
+ * @return id of the format or -1 if it is too long or the table is full.
+ */
+int register_format(const char *format);
+
+/**
+ * @return format with the given id or NULL if there is no such format.
+ */
+const char *lookup_format(int format_id);
 
 void write_log(LogMessage* log_message);
 
-LogMessage* read_log();
+/**
+ * Takes the oldest message out of the rings, merging them by timestamp. Only
+ * one process may read. Messages are ordered among those already published,
+ * a producer that was preempted before publishing its message may still be
+ * returned after newer messages of other rings.
+ *
+ * @param log_message Destination of the message.
+ * @param timeout_ms How long to wait for a message when the ring is empty,
+ *        0 returns at once.
+ *
+ * @return 1 if a message was read, 0 if nothing arrived in time or the wait
+ *         was interrupted by a signal.
+ */
+int read_log(LogMessage *log_message, int timeout_ms);
 
 void deallocate_client();
 
-void deallocate_server();
\ No newline at end of file
+void deallocate_server();
@@ -11,43 +11,490 @@
 #include <time.h>
 #include <errno.h>
 #include <signal.h>
+#include <stdarg.h>
+#include <limits.h>
 
 #include "logger_internal.h"
+#include "log_format.h"
+#include "logger.h"
 
 volatile sig_atomic_t sigint = 0;
+volatile sig_atomic_t log_level_change = 0;
 
 void handle_sigint(int sig)
 {
+    (void)sig;
     sigint = 1;
 }
 
-int main()
+/**
+ * SIGUSR1 makes the logs more verbose, SIGUSR2 less verbose.
+ */
+void handle_log_level_signal(int sig)
+{
+    log_level_change += sig == SIGUSR1 ? 1 : -1;
+}
+
+#define DEFAULT_REPORT_INTERVAL 5
+
+/**
+ * Size of the buffer the formatted lines are collected in before they are
+ * written with a single write. It is flushed early when the room left could
+ * not hold the longest possible line.
+ */
+#define OUTPUT_BUFFER_SIZE (256 * 1024)
+#define MAX_LINE_SIZE (MAX_LOG_MESSAGE_SIZE + MAX_TAG_SIZE + 64)
+
+/**
+ * Number of old files kept when the output file is rotated.
+ */
+#define ROTATED_FILES 5
+
+int binary = 0;
+uint32_t ring_size = 0;
+uint32_t ring_count = 0;
+int overflow_policy = POLICY_BLOCK;
+int report_interval = DEFAULT_REPORT_INTERVAL;
+int log_level = -1;
+char *output_filepath = NULL;
+long long rotate_size = 0;
+
+int output_fd = STDOUT_FILENO;
+long long output_file_size = 0;
+char output_buffer[OUTPUT_BUFFER_SIZE];
+int output_used = 0;
+
+unsigned long long records_total = 0;
+unsigned long long records_reported = 0;
+
+/**
+ * Parses the command line arguments.
+ *
+ * -b switches producers to binary records that are formatted by the server.
+ * -s sets the size of each ring in bytes, K and M suffixes are accepted.
+ *    Without it the size comes from LOGGER_RING_SIZE or the default.
+ * -c sets the number of rings producers are spread over by CPU. Without it
+ *    the count comes from LOGGER_RINGS or the number of online CPUs.
+ * -p sets what producers do when the ring is full: block, drop or overwrite.
+ * -i sets how often in seconds dropped records and throughput are reported.
+ * -l sets the runtime log level of all producers: none, error, info or debug.
+ * -o writes the logs to a file instead of the standard output.
+ * -r rotates the file once it grows over the given number of bytes.
+ */
+void parse_command_line_arguments(int argc, char *argv[])
+{
+    int option;
+    while ((option = getopt(argc, argv, "bs:c:p:i:l:o:r:")) != -1)
+    {
+        switch (option)
+        {
+        case 'b':
+            binary = 1;
+            break;
+        case 's':
+            ring_size = parse_ring_size(optarg);
+            if (ring_size == 0)
+            {
+                fprintf(stderr, "Invalid ring size %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'c':
+            ring_count = atoi(optarg);
+            if (ring_count == 0 || ring_count > MAX_RINGS)
+            {
+                fprintf(stderr, "Invalid ring count %s, at most %d rings are supported\n", optarg, MAX_RINGS);
+                exit(1);
+            }
+            break;
+        case 'p':
+            overflow_policy = parse_overflow_policy(optarg);
+            if (overflow_policy == -1)
+            {
+                fprintf(stderr, "Invalid overflow policy %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'i':
+            report_interval = atoi(optarg);
+            if (report_interval <= 0)
+            {
+                fprintf(stderr, "Invalid report interval %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'l':
+            log_level = parse_log_level(optarg);
+            if (log_level == -1)
+            {
+                fprintf(stderr, "Invalid log level %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'o':
+            output_filepath = optarg;
+            break;
+        case 'r':
+            rotate_size = atoll(optarg);
+            if (rotate_size <= 0)
+            {
+                fprintf(stderr, "Invalid rotation size %s\n", optarg);
+                exit(1);
+            }
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [-b] [-s ring_size] [-c ring_count] [-p block|drop|overwrite] [-i report_interval] [-l log_level] [-o file [-r rotate_size]]\n", argv[0]);
+            exit(1);
+        }
+    }
+}
+
+/**
+ * Opens the output file, appending to it if it exists.
+ */
+void open_output_file()
+{
+    struct stat file_stat;
+    output_fd = open(output_filepath, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (output_fd == -1)
+    {
+        perror("open output file");
+        exit(1);
+    }
+    output_file_size = fstat(output_fd, &file_stat) == 0 ? file_stat.st_size : 0;
+}
+
+/**
+ * Moves file to file.1, file.1 to file.2 and so on, then starts a new file.
+ */
+void rotate_output_file()
+{
+    char old_path[PATH_MAX];
+    char new_path[PATH_MAX];
+
+    close(output_fd);
+    for (int i = ROTATED_FILES - 1; i >= 1; i--)
+    {
+        snprintf(old_path, sizeof(old_path), "%s.%d", output_filepath, i);
+        snprintf(new_path, sizeof(new_path), "%s.%d", output_filepath, i + 1);
+        rename(old_path, new_path);
+    }
+    snprintf(new_path, sizeof(new_path), "%s.1", output_filepath);
+    rename(output_filepath, new_path);
+    open_output_file();
+}
+
+/**
+ * Writes the collected lines with a single write.
+ */
+void flush_output()
+{
+    int written = 0;
+    while (written < output_used)
+    {
+        ssize_t result = write(output_fd, output_buffer + written, output_used - written);
+        if (result == -1)
+        {
+            if (errno == EINTR)
+            {
+                continue;
+            }
+            perror("write");
+            break;
+        }
+        written += result;
+    }
+    output_file_size += output_used;
+    output_used = 0;
+
+    if (output_filepath != NULL && rotate_size > 0 && output_file_size >= rotate_size)
+    {
+        rotate_output_file();
+    }
+}
+
+/**
+ * Makes sure the longest possible line fits into the output buffer.
+ */
+void reserve_output()
+{
+    if (OUTPUT_BUFFER_SIZE - output_used < MAX_LINE_SIZE)
+    {
+        flush_output();
+    }
+}
+
+/**
+ * Writes the decimal digits of value, zero padded to width.
+ *
+ * @return number of characters written.
+ */
+int format_unsigned(char *output, unsigned long long value, int width)
+{
+    char digits[20];
+    int count = 0;
+    do
+    {
+        digits[count++] = '0' + value % 10;
+        value /= 10;
+    } while (value != 0);
+
+    int length = 0;
+    while (length + count < width)
+    {
+        output[length++] = '0';
+    }
+    while (count > 0)
+    {
+        output[length++] = digits[--count];
+    }
+    return length;
+}
+
+/**
+ * Appends the "[seconds.nanoseconds] " prefix of a line.
+ */
+void append_timestamp(long seconds, long nanoseconds)
+{
+    char *output = output_buffer + output_used;
+    int length = 0;
+    output[length++] = '[';
+    length += format_unsigned(output + length, seconds, 0);
+    output[length++] = '.';
+    length += format_unsigned(output + length, nanoseconds, 9);
+    output[length++] = ']';
+    output[length++] = ' ';
+    output_used += length;
+}
+
+/**
+ * Appends a message of the server itself, these are rare so printf style
+ * formatting is fine here.
+ */
+void append_server_message(char *message, ...)
 {
     struct timespec ts;
-    allocate();
-    signal(SIGINT, handle_sigint);
+    va_list args;
 
+    reserve_output();
     clock_gettime(CLOCK_REALTIME, &ts);
-    printf("[%ld.%ld] LOG_SERVER Server started\n", ts.tv_sec, ts.tv_nsec);
+    append_timestamp(ts.tv_sec, ts.tv_nsec);
 
-    while (!sigint)
+    va_start(args, message);
+    int length = vsnprintf(output_buffer + output_used, MAX_LOG_MESSAGE_SIZE, message, args);
+    va_end(args);
+    if (length > MAX_LOG_MESSAGE_SIZE - 1)
     {
-        LogMessage *log_message = read_log();
+        length = MAX_LOG_MESSAGE_SIZE - 1;
+    }
+    output_used += length;
+    output_buffer[output_used++] = '\n';
+}
 
-        printf(
-            "[%ld.%ld] %-10s [PID=%d] %s\n",
-            log_message->log_timestamp_s,
-            log_message->log_timestamp_ns,
-            log_message->log_tag,
-            log_message->pid,
-            log_message->log_message);
+/**
+ * Appends the line "[seconds.nanoseconds] TAG        [PID=pid] message",
+ * formatting binary records on the way.
+ */
+void append_log_message(LogMessage *log_message)
+{
+    reserve_output();
+    append_timestamp(log_message->log_timestamp_s, log_message->log_timestamp_ns);
 
-        free(log_message);
+    char *output = output_buffer + output_used;
+    int length = 0;
+    for (const char *tag = log_message->log_tag; *tag; tag++)
+    {
+        output[length++] = *tag;
+    }
+    while (length < MAX_TAG_SIZE)
+    {
+        output[length++] = ' ';
+    }
+    memcpy(output + length, " [PID=", 6);
+    length += 6;
+    length += format_unsigned(output + length, log_message->pid, 0);
+    output[length++] = ']';
+    output[length++] = ' ';
+
+    if (log_message->kind == LOG_RECORD_TEXT)
+    {
+        int message_length = strnlen(log_message->log_message, log_message->length);
+        memcpy(output + length, log_message->log_message, message_length);
+        length += message_length;
     }
+    else
+    {
+        const char *format = lookup_format(log_message->format_id);
+        if (format == NULL)
+        {
+            length += snprintf(output + length, MAX_LOG_MESSAGE_SIZE, "<unknown format %d>", log_message->format_id);
+        }
+        else
+        {
+            length += decode_log_arguments(format, log_message->log_message, log_message->length, output + length, MAX_LOG_MESSAGE_SIZE + 1);
+        }
+    }
+    output[length++] = '\n';
+    output_used += length;
+}
 
+/**
+ * Reports the drop counters that changed since the last report and frees the
+ * counters of producers that are gone.
+ */
+void report_dropped_logs()
+{
+    for (int i = 0; i <= MAX_PRODUCERS; i++)
+    {
+        ProducerEntry *entry = get_producer(i);
+        uint32_t state = atomic_load(&entry->state);
+        int pid = atomic_load(&entry->pid);
+        if (state == PRODUCER_FREE || (pid == 0 && i != MAX_PRODUCERS))
+        {
+            continue;
+        }
 
-    clock_gettime(CLOCK_REALTIME, &ts);
-    printf("[%ld.%ld] LOG_SERVER Exiting...\n", ts.tv_sec, ts.tv_nsec);
+        uint64_t dropped = atomic_load(&entry->dropped);
+        uint64_t overwritten = atomic_load(&entry->overwritten);
+        if (dropped != entry->reported_dropped || overwritten != entry->reported_overwritten)
+        {
+            append_server_message(
+                "LOG_SERVER [PID=%d] dropped %llu (+%llu) overwritten %llu (+%llu)",
+                pid,
+                (unsigned long long)dropped,
+                (unsigned long long)(dropped - entry->reported_dropped),
+                (unsigned long long)overwritten,
+                (unsigned long long)(overwritten - entry->reported_overwritten));
+            entry->reported_dropped = dropped;
+            entry->reported_overwritten = overwritten;
+        }
+
+        if (i != MAX_PRODUCERS && (state == PRODUCER_CLOSED || (kill(pid, 0) == -1 && errno == ESRCH)))
+        {
+            free_producer(entry);
+        }
+    }
+}
+
+/**
+ * Reports how many records were written since the last report.
+ *
+ * @param seconds Time since the last report.
+ */
+void report_throughput(double seconds)
+{
+    unsigned long long records = records_total - records_reported;
+    if (records == 0)
+    {
+        return;
+    }
+    append_server_message(
+        "LOG_SERVER %llu records in %.2fs, %.0f records/s",
+        records,
+        seconds,
+        seconds > 0 ? records / seconds : 0.0);
+    records_reported = records_total;
+}
+
+/**
+ * Applies the log level changes requested with SIGUSR1 and SIGUSR2.
+ */
+void change_log_level()
+{
+    static const char *names[] = {"none", "error", "info", "debug"};
+    int change = log_level_change;
+    log_level_change -= change;
+
+    int level = atomic_load(get_shared_log_level()) + change;
+    if (level < LOG_LEVEL_NONE)
+    {
+        level = LOG_LEVEL_NONE;
+    }
+    if (level > LOG_LEVEL_DEBUG)
+    {
+        level = LOG_LEVEL_DEBUG;
+    }
+    atomic_store(get_shared_log_level(), level);
+    append_server_message("LOG_SERVER log level set to %s", names[level]);
+    flush_output();
+}
+
+double seconds_between(struct timespec *start, struct timespec *end)
+{
+    return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+}
+
+int main(int argc, char *argv[])
+{
+    struct timespec ts;
+    struct timespec started;
+    struct timespec last_report;
+    LogMessage log_message;
+    parse_command_line_arguments(argc, argv);
+    if (output_filepath != NULL)
+    {
+        open_output_file();
+    }
+    allocate(ring_size, ring_count);
+    set_binary_mode(binary);
+    set_overflow_policy(overflow_policy);
+    if (log_level != -1)
+    {
+        atomic_store(get_shared_log_level(), log_level);
+    }
+    if (ring_size != 0 && ring_size != get_ring_size())
+    {
+        fprintf(stderr, "Logger memory already exists, using its ring size %u\n", get_ring_size());
+    }
+    if (ring_count != 0 && ring_count != get_ring_count())
+    {
+        fprintf(stderr, "Logger memory already exists, using its %u rings\n", get_ring_count());
+    }
+    signal(SIGINT, handle_sigint);
+    signal(SIGUSR1, handle_log_level_signal);
+    signal(SIGUSR2, handle_log_level_signal);
+
+    append_server_message("LOG_SERVER Server started");
+    flush_output();
+
+    clock_gettime(CLOCK_MONOTONIC, &started);
+    last_report = started;
+    while (!sigint)
+    {
+        if (log_level_change != 0)
+        {
+            change_log_level();
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        if (ts.tv_sec - last_report.tv_sec >= report_interval)
+        {
+            report_dropped_logs();
+            report_throughput(seconds_between(&last_report, &ts));
+            flush_output();
+            last_report = ts;
+        }
+
+        if (!read_log(&log_message, 1000))
+        {
+            continue;
+        }
+
+        // Drain everything that is available before paying for a write.
+        do
+        {
+            append_log_message(&log_message);
+            records_total++;
+        } while (output_used < OUTPUT_BUFFER_SIZE - MAX_LINE_SIZE && read_log(&log_message, 0));
+        flush_output();
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    report_dropped_logs();
+    records_reported = 0;
+    report_throughput(seconds_between(&started, &ts));
+    append_server_message("LOG_SERVER Exiting...");
+    flush_output();
 
     deallocate_server();
 
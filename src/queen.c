@@ -4,10 +4,12 @@
 #include <unistd.h>
 #include <errno.h>
 #include <string.h>
+#include <limits.h>
 #include <sys/msg.h>
 
 #include "logger/logger.h"
 #include "hive_ipc.h"
+#include "hive_time.h"
 
 #define log_tag "QUEEN"
 #define handle_error(x)                                                               \
@@ -20,54 +22,92 @@
 void try_clean_and_exit_with_error();
 void try_clean_and_exit();
 
-int new_bee_interval;
+long long new_bee_interval;
+long long next_egg_at;
+int clutch_size = 1;
 int next_bee_id = 0;
 
 void parse_command_line_arguments(int argc, char *argv[])
 {
-    if (argc != 2)
+    if (argc != 2 && argc != 3)
     {
-        fprintf(stderr, "Usage: %s <T> <next_bee_id>\n", argv[0]);
+        fprintf(stderr, "Usage: %s <T> [clutch_size]\n", argv[0]);
         exit(1);
     }
 
-    new_bee_interval = atoi(argv[1]);
-    log(LOG_LEVEL_INFO, "QUEEN", "New bee interval is %d", new_bee_interval);
+    if (parse_duration(argv[1], &new_bee_interval) == -1)
+    {
+        fprintf(stderr, "Invalid new bee interval %s\n", argv[1]);
+        exit(1);
+    }
+    log(LOG_LEVEL_INFO, "QUEEN", "New bee interval is %lldns", new_bee_interval);
+
+    if (argc == 3)
+    {
+        char *end;
+        long size = strtol(argv[2], &end, 10);
+        if (*end != '\0' || size < 1 || size > INT_MAX)
+        {
+            fprintf(stderr, "Invalid clutch size %s\n", argv[2]);
+            exit(1);
+        }
+        clutch_size = size;
+    }
+    log(LOG_LEVEL_INFO, "QUEEN", "Clutch size is %d", clutch_size);
 }
 
 volatile sig_atomic_t sigint = 0;
 
 void handle_sigint(int signal)
 {
+    (void)signal;
     sigint = 1;
 }
 
+/**
+ * Lays a clutch of up to clutch_size eggs. The room for the whole clutch is
+ * reserved at once, as much of it as is free, and the hive hears about it in
+ * a single message.
+ */
 void queen_lifecycle()
 {
-    if (!sigint) sleep(new_bee_interval);
-    log(LOG_LEVEL_INFO, "QUEEN", "Creating new bee, waiting for room inside");
-    handle_error(sem_wait(room_inside_semaphore));
+    if (!sigint) sleep_until(next_egg_at);
+    log(LOG_LEVEL_INFO, "QUEEN", "Creating new bees, waiting for room inside");
+    int eggs = reserve_rooms(clutch_size, &sigint);
+    handle_error(eggs);
+    if (sigint)
+    {
+        return;
+    }
 
     queen_message message;
     message.type = GIVE_BIRTH;
-    message.data = 0;
+    message.data = eggs;
 
-    log(LOG_LEVEL_INFO, "QUEEN", "Sending information to hive about new bee");
+    log(LOG_LEVEL_INFO, "QUEEN", "Sending information to hive about %d new bees", eggs);
     handle_error(msgsnd(queen_message_queue, &message, sizeof(int), 0));
 
-    log(LOG_LEVEL_INFO, "QUEEN", "Sent information to hive about new bee");
+    log(LOG_LEVEL_INFO, "QUEEN", "Sent information to hive about %d new bees", eggs);
+
+    // Eggs follow a fixed schedule, unless waiting for room made the queen miss it.
+    next_egg_at += new_bee_interval;
+    long long now = monotonic_now();
+    if (next_egg_at < now)
+    {
+        next_egg_at = now + new_bee_interval;
+    }
 }
 
 void try_clean_and_exit_with_error()
 {
-    close_semaphores();
+    close_shared_memory();
     close_logger();
     exit(1);
 }
 
 void try_clean_and_exit()
 {
-    close_semaphores();
+    close_shared_memory();
     close_logger();
     exit(0);
 }
@@ -76,11 +116,15 @@ int main(int argc, char *argv[])
 {
     init_logger();
     log(LOG_LEVEL_INFO, "QUEEN", "Starting queen");
-    signal(SIGINT, handle_sigint);
+    // No SA_RESTART, the queen waiting for room must wake up on SIGINT.
+    struct sigaction action = {.sa_handler = handle_sigint};
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
     parse_command_line_arguments(argc, argv);
     initialize_queen_message_queue();
-    open_semaphores(0);
+    handle_error(open_shared_memory(0));
 
+    next_egg_at = monotonic_now() + new_bee_interval;
     while (!sigint)
     {
         queen_lifecycle();
@@ -0,0 +1,115 @@
+#include "queen_task.h"
+#include "timer_wheel.h"
+#include "hive_ipc.h"
+#include "hive_time.h"
+#include "logger/logger.h"
+
+#include <pthread.h>
+
+#define log_tag "QUEEN"
+
+/**
+ * Eggs laid but not hatched yet, whether a clutch is due but waits for room
+ * and whether the queen still lays, guarded by queen_lock. stopped lets
+ * reserve_rooms give up once the queen stops.
+ */
+static pthread_mutex_t queen_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t clutch_laid = PTHREAD_COND_INITIALIZER;
+static int laid_eggs = 0;
+static int waiting_for_room = 0;
+static int laying = 0;
+static volatile sig_atomic_t stopped = 0;
+
+static timer_entry queen_timer;
+static long long interval;
+static long long next_egg_at;
+static int clutch;
+
+static void lay_clutch(timer_entry *entry);
+
+/**
+ * Schedules the next clutch once the eggs of this one are laid. Eggs follow
+ * a fixed schedule, unless waiting for room made the queen miss it.
+ */
+static void schedule_next_clutch(int eggs)
+{
+    log(LOG_LEVEL_INFO, log_tag, "Laid %d eggs", eggs);
+    next_egg_at += interval;
+    long long now = monotonic_now();
+    if (next_egg_at < now)
+    {
+        next_egg_at = now + interval;
+    }
+    schedule_timer(&queen_timer, next_egg_at - now, lay_clutch);
+}
+
+/**
+ * Lays a clutch if there is room for at least one egg. Runs on the timer
+ * thread, so it never waits for room: when the hive is full the thread in
+ * await_clutch waits for it instead, woken by the bees releasing their room
+ * like ./bin/queen, and the timer is not armed again until it got some.
+ */
+static void lay_clutch(timer_entry *entry)
+{
+    (void)entry;
+    int eggs = try_reserve_rooms(clutch);
+
+    pthread_mutex_lock(&queen_lock);
+    if (eggs == 0)
+    {
+        waiting_for_room = 1;
+    }
+    laid_eggs += eggs;
+    pthread_cond_signal(&clutch_laid);
+    pthread_mutex_unlock(&queen_lock);
+
+    if (eggs > 0)
+    {
+        schedule_next_clutch(eggs);
+    }
+}
+
+void start_queen_task(long long new_bee_interval, int clutch_size)
+{
+    interval = new_bee_interval;
+    clutch = clutch_size;
+    laying = 1;
+    stopped = 0;
+    next_egg_at = monotonic_now() + interval;
+    schedule_timer(&queen_timer, interval, lay_clutch);
+    log(LOG_LEVEL_INFO, log_tag, "Queen runs in the hive, new bee interval is %lldns, clutch size is %d",
+        interval, clutch);
+}
+
+int await_clutch()
+{
+    pthread_mutex_lock(&queen_lock);
+    while (laying && laid_eggs == 0 && !waiting_for_room)
+    {
+        pthread_cond_wait(&clutch_laid, &queen_lock);
+    }
+    int eggs = laying ? laid_eggs : -1;
+    int wait = laying && eggs == 0;
+    laid_eggs = 0;
+    waiting_for_room = 0;
+    pthread_mutex_unlock(&queen_lock);
+
+    if (wait)
+    {
+        eggs = reserve_rooms(clutch, &stopped);
+        if (eggs > 0)
+        {
+            schedule_next_clutch(eggs);
+        }
+    }
+    return eggs;
+}
+
+void stop_queen_task()
+{
+    pthread_mutex_lock(&queen_lock);
+    laying = 0;
+    stopped = 1;
+    pthread_cond_broadcast(&clutch_laid);
+    pthread_mutex_unlock(&queen_lock);
+}
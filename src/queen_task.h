@@ -0,0 +1,40 @@
+#ifndef QUEEN_TASK_H
+#define QUEEN_TASK_H
+
+/**
+ * Where the queen runs. QUEEN_PROCESS launches ./bin/queen, which tells the
+ * hive about its eggs through the queen message queue. QUEEN_TASK runs the
+ * queen as a timer of the hive, without the queue and without a process.
+ */
+#define QUEEN_PROCESS 0
+#define QUEEN_TASK 1
+
+/**
+ * Starts laying eggs on the timer wheel of the hive, a clutch of up to
+ * clutch_size eggs every new_bee_interval, following the same schedule and
+ * the same room rules as ./bin/queen. When the hive is full the thread in
+ * await_clutch waits for room, the timer thread never does. Should be used after
+ * start_timer_service and open_shared_memory.
+ *
+ * @param new_bee_interval - time between clutches in ns (T)
+ * @param clutch_size - most eggs laid at once
+ */
+void start_queen_task(long long new_bee_interval, int clutch_size);
+
+/**
+ * Waits for the next clutch laid by the queen task, the room for all of its
+ * eggs is already reserved. Clutches laid while nobody waited are merged.
+ * When a clutch is due in a full hive, waits for room and lays it.
+ *
+ * @return int - number of eggs, -1 once the queen task was stopped
+ */
+int await_clutch();
+
+/**
+ * Stops the queen task and wakes up the thread waiting for a clutch or for
+ * room. The timer service must be stopped first so the queen timer no longer
+ * fires, and the woken thread joined before the bees it launches are freed.
+ */
+void stop_queen_task();
+
+#endif
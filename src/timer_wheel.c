@@ -0,0 +1,192 @@
+#include "timer_wheel.h"
+#include "logger/logger.h"
+
+#include <pthread.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+
+#define log_tag "TIMER"
+
+#define TIMER_SLOTS (1 << TIMER_LEVEL_BITS)
+#define TIMER_MASK (TIMER_SLOTS - 1)
+
+/**
+ * Ticks are counted from the start of the service, current is the next tick
+ * to process. All the fields are guarded by timer_lock.
+ */
+static pthread_mutex_t timer_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t timer_cond;
+static timer_entry *wheel[TIMER_LEVELS][TIMER_SLOTS];
+static uint64_t current;
+static long long started_ns;
+static int pending = 0;
+static volatile int running = 0;
+static pthread_t timer_thread;
+
+static long long now_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * Puts the entry into the slot of the level that covers its distance from the
+ * current tick, timer_lock must be held.
+ */
+static void insert_timer(timer_entry *entry)
+{
+    uint64_t expires = entry->expires;
+    if (expires < current)
+    {
+        expires = current;
+    }
+
+    uint64_t distance = expires - current;
+    int level = 0;
+    while (level < TIMER_LEVELS - 1 && distance >= (1ULL << (TIMER_LEVEL_BITS * (level + 1))))
+    {
+        level++;
+    }
+    if (distance >= (1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS)))
+    {
+        // Too far away, park it in the last slot it can reach and place it again later.
+        expires = current + (1ULL << (TIMER_LEVEL_BITS * TIMER_LEVELS)) - 1;
+    }
+
+    timer_entry **slot = &wheel[level][(expires >> (TIMER_LEVEL_BITS * level)) & TIMER_MASK];
+    entry->next = *slot;
+    *slot = entry;
+}
+
+/**
+ * Moves the timers of one slot of a higher level down to the lower levels.
+ *
+ * @return index of the slot, 0 means the level wrapped around as well
+ */
+static int cascade(int level, int index)
+{
+    timer_entry *entry = wheel[level][index];
+    wheel[level][index] = NULL;
+    while (entry)
+    {
+        timer_entry *next = entry->next;
+        insert_timer(entry);
+        entry = next;
+    }
+    return index;
+}
+
+/**
+ * Processes one tick and takes out the timers that expired in it, timer_lock
+ * must be held.
+ *
+ * @return list of the expired timers
+ */
+static timer_entry *advance_tick()
+{
+    int index = current & TIMER_MASK;
+    if (index == 0)
+    {
+        for (int level = 1; level < TIMER_LEVELS; level++)
+        {
+            if (cascade(level, (current >> (TIMER_LEVEL_BITS * level)) & TIMER_MASK) != 0)
+            {
+                break;
+            }
+        }
+    }
+    current++;
+
+    timer_entry *expired = wheel[0][index];
+    wheel[0][index] = NULL;
+    return expired;
+}
+
+static void *timer_thread_function(void *arg)
+{
+    (void)arg;
+    pthread_mutex_lock(&timer_lock);
+    while (running)
+    {
+        if (pending == 0)
+        {
+            // Nothing to wait for, keep the tick count in step with the clock.
+            current = (now_ns() - started_ns) / TIMER_TICK_NS;
+            pthread_cond_wait(&timer_cond, &timer_lock);
+            continue;
+        }
+
+        uint64_t now = (now_ns() - started_ns) / TIMER_TICK_NS;
+        while (current <= now && running)
+        {
+            timer_entry *expired = advance_tick();
+            pthread_mutex_unlock(&timer_lock);
+            while (expired)
+            {
+                timer_entry *next = expired->next;
+                __atomic_fetch_sub(&pending, 1, __ATOMIC_RELAXED);
+                expired->callback(expired);
+                expired = next;
+            }
+            pthread_mutex_lock(&timer_lock);
+        }
+
+        long long wake_up = started_ns + (long long)current * TIMER_TICK_NS;
+        struct timespec deadline = {
+            .tv_sec = wake_up / 1000000000LL,
+            .tv_nsec = wake_up % 1000000000LL};
+        pthread_cond_timedwait(&timer_cond, &timer_lock, &deadline);
+    }
+    pthread_mutex_unlock(&timer_lock);
+    return NULL;
+}
+
+int start_timer_service()
+{
+    pthread_condattr_t attributes;
+    pthread_condattr_init(&attributes);
+    pthread_condattr_setclock(&attributes, CLOCK_MONOTONIC);
+    pthread_cond_init(&timer_cond, &attributes);
+    pthread_condattr_destroy(&attributes);
+
+    memset(wheel, 0, sizeof(wheel));
+    pending = 0;
+    started_ns = now_ns();
+    current = 0;
+    running = 1;
+    if (pthread_create(&timer_thread, NULL, timer_thread_function, NULL) != 0)
+    {
+        log(LOG_LEVEL_ERROR, log_tag, "ERROR %s at %s\n", strerror(errno), __func__);
+        running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void schedule_timer(timer_entry *entry, long long delay_ns, void (*callback)(timer_entry *entry))
+{
+    entry->callback = callback;
+    pthread_mutex_lock(&timer_lock);
+    entry->expires = (now_ns() - started_ns + delay_ns + TIMER_TICK_NS - 1) / TIMER_TICK_NS;
+    insert_timer(entry);
+    if (__atomic_fetch_add(&pending, 1, __ATOMIC_RELAXED) == 0)
+    {
+        pthread_cond_signal(&timer_cond);
+    }
+    pthread_mutex_unlock(&timer_lock);
+}
+
+void stop_timer_service()
+{
+    if (!running)
+    {
+        return;
+    }
+    pthread_mutex_lock(&timer_lock);
+    running = 0;
+    pthread_cond_signal(&timer_cond);
+    pthread_mutex_unlock(&timer_lock);
+    pthread_join(timer_thread, NULL);
+}
@@ -0,0 +1,53 @@
+#ifndef TIMER_WHEEL_H
+#define TIMER_WHEEL_H
+
+#include <stdint.h>
+
+/**
+ * Length of one tick of the timer wheel, timers expire at tick boundaries.
+ */
+#define TIMER_TICK_NS 1000000LL
+
+/**
+ * Bits of the tick used by each level of the wheel and the number of levels.
+ * Level n holds the timers expiring within 64^(n+1) ticks, timers further
+ * away wait in the last level and are moved down as their time comes.
+ */
+#define TIMER_LEVEL_BITS 6
+#define TIMER_LEVELS 5
+
+/**
+ * Timer embedded in the structure it belongs to, so scheduling never
+ * allocates. An entry must not be scheduled again before it expired.
+ */
+typedef struct timer_entry
+{
+    struct timer_entry *next;
+    uint64_t expires;                               /* tick at which the timer expires */
+    void (*callback)(struct timer_entry *entry);
+} timer_entry;
+
+/**
+ * Starts the thread that advances the timer wheel of the hive.
+ *
+ * @return int - 0 if the thread was started, -1 otherwise
+ */
+int start_timer_service();
+
+/**
+ * Schedules the callback to run on the timer thread once the delay passed.
+ * Inserting a timer takes constant time regardless of how many are pending.
+ * The callback must not block, it should only hand work to other threads.
+ *
+ * @param entry - timer to schedule
+ * @param delay_ns - delay in nanoseconds, rounded up to whole ticks
+ * @param callback - function called with the entry when the timer expires
+ */
+void schedule_timer(timer_entry *entry, long long delay_ns, void (*callback)(timer_entry *entry));
+
+/**
+ * Stops the timer thread, pending timers never expire.
+ */
+void stop_timer_service();
+
+#endif
@@ -0,0 +1,31 @@
+#ifndef TEST_H
+#define TEST_H
+
+#include <stdio.h>
+
+/**
+ * Minimal checks shared by the tests, each test is a program that exits with
+ * 0 when all its checks passed. Run them with make test.
+ */
+static int failed_checks = 0;
+
+#define check(condition)                                                                 \
+    do                                                                                   \
+    {                                                                                    \
+        if (!(condition))                                                                \
+        {                                                                                \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+            failed_checks++;                                                             \
+        }                                                                                \
+    } while (0)
+
+/**
+ * @return int - exit code of the test, 1 if any check failed
+ */
+static inline int test_result(const char *name)
+{
+    printf("%s: %s\n", name, failed_checks ? "FAILED" : "passed");
+    return failed_checks ? 1 : 0;
+}
+
+#endif
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../src/logger/logger.h"
+#include "../src/logger/logger_internal.h"
+#include "../src/hive_ipc.h"
+
+#define GATES 2
+#define VISITS 10000
+
+/**
+ * The allocator of glibc, the definitions below replace malloc for the whole
+ * process, including the calls made inside the C library.
+ */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *pointer, size_t size);
+
+static _Atomic int counting = 0;
+static _Atomic int allocations = 0;
+
+void *malloc(size_t size)
+{
+    atomic_fetch_add(&allocations, atomic_load(&counting));
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size)
+{
+    atomic_fetch_add(&allocations, atomic_load(&counting));
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *pointer, size_t size)
+{
+    atomic_fetch_add(&allocations, atomic_load(&counting));
+    return __libc_realloc(pointer, size);
+}
+
+static void start_counting()
+{
+    atomic_store(&allocations, 0);
+    atomic_store(&counting, 1);
+}
+
+/**
+ * Stops counting and checks that nothing was allocated since start_counting.
+ */
+static void check_no_allocations(const char *path)
+{
+    atomic_store(&counting, 0);
+    int count = atomic_load(&allocations);
+    check(count == 0);
+    if (count != 0)
+    {
+        fprintf(stderr, "%d allocations in %s\n", count, path);
+    }
+}
+
+static volatile sig_atomic_t stop = 0;
+static int gate_ids[GATES];
+
+/**
+ * Lets the bees through the gate the way the gate thread of the hive does:
+ * picks the oldest request of the direction chosen by next_direction, takes
+ * it, passes the gate and grants it.
+ */
+static void *gate_thread_function(void *arg)
+{
+    int gate_id = *(int *)arg;
+    gate_control_block *gate = &hive_shared->gates[gate_id];
+    gate_schedule schedule = {.direction = -1, .platoon = 0};
+    while (!stop)
+    {
+        uint32_t requests = atomic_load(&gate->requests);
+        gate_slot *oldest[2] = {NULL, NULL};
+        int waiting[2] = {0, 0};
+        for (int i = 0; i < GATE_SLOTS; i++)
+        {
+            gate_slot *slot = &gate->slots[i];
+            if (atomic_load(&slot->state) != SLOT_REQUESTED)
+            {
+                continue;
+            }
+            int way = slot->delta == 1;
+            waiting[way]++;
+            if (oldest[way] == NULL || (int32_t)(slot->ticket - oldest[way]->ticket) < 0)
+            {
+                oldest[way] = slot;
+            }
+        }
+
+        int direction = next_direction(&schedule, waiting[1], waiting[0]);
+        if (direction == 0)
+        {
+            wait_for_gate_requests(gate_id, requests);
+            continue;
+        }
+        gate_slot *slot = oldest[direction == 1];
+        if (!take_gate_request(slot))
+        {
+            continue;
+        }
+        atomic_fetch_add_explicit(&gate->bees_delta, direction, memory_order_relaxed);
+        pass_gate(gate_id, direction);
+        log(LOG_LEVEL_DEBUG, "GATE", "Gate %d: %d bees inside", gate_id, count_bees_inside());
+        grant_gate_request(slot);
+    }
+    return NULL;
+}
+
+/**
+ * Crosses the gates in and out as a bee does, with the gate threads running
+ * on a private hive segment, and checks that neither side allocates.
+ */
+static void test_gate_path()
+{
+    check(open_shared_memory(1) == 0);
+    if (hive_shared == NULL)
+    {
+        return;
+    }
+    set_room_capacity(1);
+    hive_shared->gate_count = GATES;
+
+    pthread_t gate_threads[GATES];
+    for (int i = 0; i < GATES; i++)
+    {
+        gate_ids[i] = i;
+        check(pthread_create(&gate_threads[i], NULL, gate_thread_function, &gate_ids[i]) == 0);
+    }
+
+    start_counting();
+    for (int i = 0; i < VISITS; i++)
+    {
+        check(reserve_room(&stop) == 0);
+        int gate = choose_gate(1);
+        join_gate(gate);
+        check(cross_gate_shared(gate, 1) == 0);
+        gate = choose_gate(-1);
+        join_gate(gate);
+        check(cross_gate_shared(gate, -1) == 0);
+        release_room();
+    }
+    check(try_reserve_rooms(2) == 1);
+    release_room();
+    check_no_allocations("the gate path");
+    check(count_bees_inside() == 0);
+
+    stop = 1;
+    wake_gate_threads();
+    for (int i = 0; i < GATES; i++)
+    {
+        pthread_join(gate_threads[i], NULL);
+    }
+    close_shared_memory();
+    unlink_shared_memory();
+}
+
+/**
+ * Logs in text and binary mode and checks that log_write never touches the
+ * heap. Nothing reads the records, so the ring drops them once it is full.
+ */
+static void test_log_write()
+{
+    for (int binary = 0; binary <= 1; binary++)
+    {
+        set_binary_mode(binary);
+        start_counting();
+        for (int i = 0; i < VISITS; i++)
+        {
+            log_write(LOG_LEVEL_INFO, "TEST", "Bee %d left gate %d after %lld ns: %s", i, i % 4, 1000LL * i, "outside");
+            log_write(LOG_LEVEL_DEBUG, "VERY_LONG_TAG", "No arguments");
+        }
+        check_no_allocations(binary ? "log_write in binary mode" : "log_write in text mode");
+    }
+}
+
+/**
+ * Runs on segments of its own, so a logger server or a hive running at the
+ * same time is not disturbed.
+ */
+int main()
+{
+    char logger_name[64];
+    char hive_name[64];
+    snprintf(logger_name, sizeof(logger_name), "/test_allocations_logger_%d", getpid());
+    snprintf(hive_name, sizeof(hive_name), "/test_allocations_hive_%d", getpid());
+    setenv(LOGGER_SHM_VARIABLE, logger_name, 1);
+    setenv(HIVE_SHM_VARIABLE, hive_name, 1);
+
+    init_logger();
+    set_overflow_policy(POLICY_DROP_NEWEST);
+
+    test_log_write();
+    set_binary_mode(0);
+    test_gate_path();
+
+    close_logger();
+    deallocate_server();
+    return test_result("allocations");
+}
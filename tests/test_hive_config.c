@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "test.h"
+#include "../src/hive_config.h"
+#include "../src/hive_ipc.h"
+
+static const config_limits default_limits = {
+    .max_number = DEFAULT_MAX_NUMBER,
+    .min_duration = DEFAULT_MIN_DURATION,
+    .max_duration = DEFAULT_MAX_DURATION};
+
+static char path[] = "/tmp/test_hive_config_XXXXXX";
+static char error[256];
+
+/**
+ * Writes the bytes to the test file.
+ */
+static void write_file(const void *data, size_t size)
+{
+    FILE *file = fopen(path, "wb");
+    check(file != NULL);
+    if (file != NULL)
+    {
+        check(fwrite(data, 1, size, file) == size);
+        fclose(file);
+    }
+}
+
+/**
+ * Loads the text as a config with the limits.
+ *
+ * @return int - result of load_hive_config
+ */
+static int load_text(const char *text, const config_limits *limits, hive_config *config)
+{
+    write_file(text, strlen(text));
+    error[0] = '\0';
+    return load_hive_config(path, limits, config, error, sizeof(error));
+}
+
+/**
+ * Checks that the text is rejected with an error containing the reason.
+ */
+static void check_invalid(const char *text, const char *reason)
+{
+    hive_config config;
+    check(load_text(text, &default_limits, &config) == -1);
+    check(config.bees == NULL);
+    check(strstr(error, reason) != NULL);
+    if (strstr(error, reason) == NULL)
+    {
+        fprintf(stderr, "config \"%s\": error \"%s\", expected \"%s\"\n", text, error, reason);
+    }
+}
+
+static void test_text_config()
+{
+    hive_config config;
+    check(load_text("4 2\n2\n1 2 3 4\n5 6 7 8\n", &default_limits, &config) == 0);
+    check(config.number_of_bees == 4);
+    check(config.max_bees_capacity == 2);
+    check(config.new_bee_interval == 2 * NS_PER_SECOND);
+    check(config.gates_number == DEFAULT_GATES_NUMBER);
+    for (int i = 0; i < 4; i++)
+    {
+        check(config.bees[i].id == i);
+        check(config.bees[i].time_in_hive == (i + 1) * NS_PER_SECOND);
+        check(config.bees[i].life_span == i + 5);
+        check(config.bees[i].starts_in_hive == 0);
+    }
+    free(config.bees);
+
+    // Units, any whitespace between the values and an explicit number of gates.
+    check(load_text("4\t2 250ms\r\n1s 2ms 3us 1000ns 1 1 1 1\n\n3\n", &default_limits, &config) == 0);
+    check(config.new_bee_interval == 250 * NS_PER_MILLISECOND);
+    check(config.bees[0].time_in_hive == NS_PER_SECOND);
+    check(config.bees[1].time_in_hive == 2 * NS_PER_MILLISECOND);
+    check(config.bees[2].time_in_hive == 3 * NS_PER_MICROSECOND);
+    check(config.bees[3].time_in_hive == 1000);
+    check(config.gates_number == 3);
+    free(config.bees);
+
+    // No trailing newline, the end of the file ends the last token.
+    check(load_text("2 1 1 1 1 1 1 64", &default_limits, &config) == 0);
+    check(config.gates_number == MAX_GATES);
+    free(config.bees);
+
+    config_limits limits = {.max_number = 1000, .min_duration = 1, .max_duration = 10 * NS_PER_SECOND};
+    check(load_text("200 100\n1ns\n", &limits, &config) == -1);
+    check(strstr(error, "T_1") != NULL);
+
+    check_invalid("", "(N)");
+    check_invalid("4a 2\n2\n", "(N)");
+    check_invalid("0 1\n1\n", "(N)");
+    check_invalid("101 1\n1\n", "(N)");
+    check_invalid("4 -2\n1\n", "(P)");
+    check_invalid("4 2\n", "(T)");
+    check_invalid("4 2\n101\n", "(T)");
+    check_invalid("4 2\n2h\n", "(T)");
+    check_invalid("3 2\n1\n1 1 1\n1 1 1\n", "maximum hive capacity");
+    check_invalid("4 2\n1\n1 1 1 1ns\n1 1 1 1\n", "(T_4)");
+    check_invalid("4 2\n1\n1 1 1 1\n1 1 1\n", "(X_4)");
+    check_invalid("4 2\n1\n1 1 1 1\n1 1 1 101\n", "(X_4)");
+    check_invalid("4 2\n1\n1 1 1 1\n1 1 1 1\n0\n", "(G)");
+    check_invalid("4 2\n1\n1 1 1 1\n1 1 1 1\n65\n", "(G)");
+    check_invalid("4 2\n1\n1 1 1 1\n1 1 1 1\n2 extra\n", "Unexpected data");
+    check_invalid("4 2\n1\n1 1 1 1\n1 1 1 1\n2\n3\n", "Unexpected data");
+}
+
+static void test_binary_config()
+{
+    bee_config bees[4];
+    hive_config saved = {
+        .number_of_bees = 4,
+        .max_bees_capacity = 2,
+        .new_bee_interval = 1500 * NS_PER_MILLISECOND,
+        .gates_number = 5,
+        .bees = bees};
+    for (int i = 0; i < 4; i++)
+    {
+        bees[i].time_in_hive = (i + 1) * NS_PER_MICROSECOND;
+        bees[i].life_span = 10 * (i + 1);
+    }
+    check(save_binary_config(path, &saved) == 0);
+
+    hive_config config;
+    check(load_hive_config(path, &default_limits, &config, error, sizeof(error)) == 0);
+    check(config.number_of_bees == 4);
+    check(config.max_bees_capacity == 2);
+    check(config.new_bee_interval == 1500 * NS_PER_MILLISECOND);
+    check(config.gates_number == 5);
+    for (int i = 0; i < 4; i++)
+    {
+        check(config.bees[i].id == i);
+        check(config.bees[i].time_in_hive == bees[i].time_in_hive);
+        check(config.bees[i].life_span == bees[i].life_span);
+    }
+    free(config.bees);
+
+    // The file is the header, the times and the life spans.
+    size_t size = sizeof(binary_config_header) + 4 * (sizeof(int64_t) + sizeof(uint32_t));
+    char data[sizeof(binary_config_header) + 4 * (sizeof(int64_t) + sizeof(uint32_t)) + 1];
+    FILE *file = fopen(path, "rb");
+    check(file != NULL && fread(data, 1, sizeof(data), file) == size);
+    if (file != NULL)
+    {
+        fclose(file);
+    }
+    binary_config_header *header = (binary_config_header *)data;
+
+    write_file(data, size - 1);
+    check(load_hive_config(path, &default_limits, &config, error, sizeof(error)) == -1);
+    check(strstr(error, "size") != NULL);
+    write_file(data, size + 1);
+    check(load_hive_config(path, &default_limits, &config, error, sizeof(error)) == -1);
+
+    header->gates_number = MAX_GATES + 1;
+    write_file(data, size);
+    check(load_hive_config(path, &default_limits, &config, error, sizeof(error)) == -1);
+    check(strstr(error, "(G)") != NULL);
+    header->gates_number = 5;
+
+    header->number_of_bees = 0xffffffffu;
+    write_file(data, size);
+    check(load_hive_config(path, &default_limits, &config, error, sizeof(error)) == -1);
+    check(strstr(error, "(N)") != NULL);
+    header->number_of_bees = 4;
+
+    int64_t time_in_hive = 0;
+    memcpy(data + sizeof(binary_config_header) + 2 * sizeof(int64_t), &time_in_hive, sizeof(time_in_hive));
+    write_file(data, size);
+    check(load_hive_config(path, &default_limits, &config, error, sizeof(error)) == -1);
+    check(strstr(error, "(T_3)") != NULL);
+    check(config.bees == NULL);
+}
+
+int main()
+{
+    int fd = mkstemp(path);
+    check(fd != -1);
+    if (fd == -1)
+    {
+        return test_result("hive_config");
+    }
+    close(fd);
+
+    test_text_config();
+    test_binary_config();
+
+    hive_config config;
+    unlink(path);
+    check(load_hive_config(path, &default_limits, &config, error, sizeof(error)) == -1);
+    return test_result("hive_config");
+}
@@ -0,0 +1,70 @@
+#include <limits.h>
+
+#include "test.h"
+#include "../src/hive_time.h"
+
+/**
+ * Checks that the text parses to the duration.
+ */
+static void check_duration(const char *text, long long expected)
+{
+    long long duration = -1;
+    check(parse_duration(text, &duration) == 0);
+    check(duration == expected);
+    if (duration != expected)
+    {
+        fprintf(stderr, "\"%s\" parsed as %lld, expected %lld\n", text, duration, expected);
+    }
+}
+
+/**
+ * Checks that the text is rejected and the output is left untouched.
+ */
+static void check_invalid(const char *text)
+{
+    long long duration = 42;
+    check(parse_duration(text, &duration) == -1);
+    check(duration == 42);
+    if (duration != 42)
+    {
+        fprintf(stderr, "\"%s\" was accepted\n", text);
+    }
+}
+
+int main()
+{
+    check_duration("2", 2 * NS_PER_SECOND);
+    check_duration("0", 0);
+    check_duration("007", 7 * NS_PER_SECOND);
+    check_duration("3s", 3 * NS_PER_SECOND);
+    check_duration("250ms", 250 * NS_PER_MILLISECOND);
+    check_duration("40us", 40 * NS_PER_MICROSECOND);
+    check_duration("15ns", 15);
+    check_duration("9223372036854775807ns", LLONG_MAX);
+    check_duration("9223372036s", 9223372036LL * NS_PER_SECOND);
+
+    check_invalid("");
+    check_invalid("s");
+    check_invalid("ms");
+    check_invalid("-1");
+    check_invalid("+1");
+    check_invalid(" 1");
+    check_invalid("1 ");
+    check_invalid("1.5");
+    check_invalid("1m");
+    check_invalid("1h");
+    check_invalid("1MS");
+    check_invalid("1mss");
+    check_invalid("1sms");
+    check_invalid("9223372036854775808ns");
+    check_invalid("9223372037s");
+    check_invalid("9223372036855ms");
+
+    // Only the given length is parsed, the rest of the text is not looked at.
+    long long duration = 0;
+    check(parse_duration_length("12ms34", 4, &duration) == 0 && duration == 12 * NS_PER_MILLISECOND);
+    check(parse_duration_length("12ms34", 3, &duration) == -1);
+    check(parse_duration_length("5", 0, &duration) == -1);
+
+    return test_result("hive_time");
+}
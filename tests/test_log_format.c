@@ -0,0 +1,96 @@
+#include <stdarg.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <limits.h>
+
+#include "test.h"
+#include "../src/logger/log_format.h"
+
+#define BUFFER_SIZE 1024
+
+/**
+ * Encodes the arguments, decodes them and checks the result against what
+ * vsnprintf prints for the same format and arguments.
+ */
+static void check_round_trip(const char *format, ...)
+{
+    char encoded[BUFFER_SIZE];
+    char decoded[BUFFER_SIZE];
+    char expected[BUFFER_SIZE];
+    va_list args;
+
+    va_start(args, format);
+    va_list encode_args;
+    va_copy(encode_args, args);
+    int length = encode_log_arguments(format, encode_args, encoded, sizeof(encoded));
+    va_end(encode_args);
+    vsnprintf(expected, sizeof(expected), format, args);
+    va_end(args);
+
+    check(length >= 0);
+    if (length < 0)
+    {
+        return;
+    }
+    int written = decode_log_arguments(format, encoded, length, decoded, sizeof(decoded));
+    check(written == (int)strlen(decoded));
+    check(strcmp(decoded, expected) == 0);
+    if (strcmp(decoded, expected) != 0)
+    {
+        fprintf(stderr, "format \"%s\": decoded \"%s\", expected \"%s\"\n", format, decoded, expected);
+    }
+}
+
+/**
+ * @return int - result of encoding the arguments into a buffer of the size
+ */
+static int encode(char *buffer, int size, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int length = encode_log_arguments(format, args, buffer, size);
+    va_end(args);
+    return length;
+}
+
+int main()
+{
+    check_round_trip("no conversions");
+    check_round_trip("%d %i %d", 0, -42, INT_MAX);
+    check_round_trip("%u %x %X %o", UINT_MAX, 0xbeefu, 0xbeefu, 8u);
+    check_round_trip("%ld %lld %llu", LONG_MIN, LLONG_MIN, ULLONG_MAX);
+    check_round_trip("%zu %jd %td", (size_t)12345, (intmax_t)-7, (ptrdiff_t)-3);
+    check_round_trip("%hhd %hhu %hd %hu", 300, 300, 70000, 70000);
+    check_round_trip("%c%c", 'o', 'k');
+    check_round_trip("%f %.3e %g %5.1f", 3.5, -0.000125, 1e20, 2.25);
+    check_round_trip("%s and %s", "first", "");
+    check_round_trip("%s", (char *)NULL);
+    check_round_trip("%p", (void *)0x1234);
+    check_round_trip("100%% of %d", 20);
+    check_round_trip("[%8d] [%-8d] [%08.3f] [%+d]", 42, 42, 3.14159, 5);
+    check_round_trip("[%*d] [%-*.*s]", 6, 42, 10, 3, "abcdef");
+    check_round_trip("Bee %d left gate %d after %lld ns: %s", 7, 2, 123456789LL, "outside");
+
+    char buffer[BUFFER_SIZE];
+    // Conversions that can not be encoded fall back to text.
+    check(encode(buffer, sizeof(buffer), "%d %m", 1) == -1);
+    check(encode(buffer, sizeof(buffer), "%Q", 1) == -1);
+    // Arguments that do not fit are rejected instead of cut.
+    check(encode(buffer, 8, "%d", 1) == 8);
+    check(encode(buffer, 15, "%d %d", 1, 2) == -1);
+    check(encode(buffer, 6, "%s", "longer") == -1);
+    check(encode(buffer, 8, "%s", "longer") == 8);
+
+    // The decoded message is cut to the output and stays terminated.
+    int length = encode(buffer, sizeof(buffer), "%s tail", "head");
+    char output[6];
+    check(decode_log_arguments("%s tail", buffer, length, output, sizeof(output)) == 5);
+    check(strcmp(output, "head ") == 0);
+
+    // Missing argument bytes decode as zero and empty strings.
+    check(decode_log_arguments("%d %s!", buffer, 0, output, sizeof(output)) == 3);
+    check(strcmp(output, "0 !") == 0);
+
+    return test_result("log_format");
+}
@@ -0,0 +1,364 @@
+// Included first, it defines _GNU_SOURCE, to reach the rings and the records of the segment directly.
+#include "../src/logger/logger_internal.c"
+
+#include <pthread.h>
+#include <sys/wait.h>
+#include <time.h>
+
+#include "test.h"
+
+#define PRODUCERS 4
+#define RECORDS_PER_PRODUCER 20000
+
+/**
+ * Maps a fresh segment of the test with the given rings and overflow policy.
+ */
+static void open_rings(uint32_t ring_size, uint32_t ring_count, int policy)
+{
+    deallocate_server();
+    allocate(ring_size, ring_count);
+    set_overflow_policy(policy);
+
+    // The reader keeps its pending messages between calls, start over with the new rings.
+    free(pending_messages);
+    pending_messages = NULL;
+    memset(pending, 0, sizeof(pending));
+    pending_count = 0;
+}
+
+static void close_rings()
+{
+    deallocate_client();
+    deallocate_server();
+}
+
+/**
+ * Fills a text message of the producer with the sequence number first and
+ * pads it to the length.
+ */
+static void make_message(LogMessage *message, int producer, int sequence, int length)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    message->kind = LOG_RECORD_TEXT;
+    message->format_id = 0;
+    message->log_timestamp_s = now.tv_sec;
+    message->log_timestamp_ns = now.tv_nsec;
+    message->log_level = LOG_LEVEL_INFO;
+    message->pid = getpid();
+    strcpy(message->log_tag, "RING");
+    int used = snprintf(message->log_message, MAX_LOG_MESSAGE_SIZE, "%d %d", producer, sequence);
+    memset(message->log_message + used, '.', length > used ? length - used : 0);
+    message->length = length > used ? length : used;
+}
+
+/**
+ * Reads a message back.
+ *
+ * @return int - sequence number of the message and its producer, -1 if no
+ *         message arrived in time
+ */
+static int read_message(int *producer)
+{
+    LogMessage message;
+    if (!read_log(&message, 1000))
+    {
+        return -1;
+    }
+    int sequence = -1;
+    message.log_message[message.length] = '\0';
+    sscanf(message.log_message, "%d %d", producer, &sequence);
+    return sequence;
+}
+
+static void *producer_thread_function(void *arg)
+{
+    int producer = (int)(intptr_t)arg;
+    LogMessage message;
+    for (int i = 0; i < RECORDS_PER_PRODUCER; i++)
+    {
+        make_message(&message, producer, i, 16 + (i * 7 + producer) % 200);
+        write_log(&message);
+    }
+    return NULL;
+}
+
+/**
+ * Runs producer threads against a small blocking ring and checks that every
+ * record is read back exactly once. With a single ring the records of each
+ * producer must also come back in the order they were written.
+ */
+static void test_concurrent_producers(uint32_t ring_count)
+{
+    open_rings(MIN_RING_SIZE, ring_count, POLICY_BLOCK);
+
+    pthread_t producers[PRODUCERS];
+    for (int i = 0; i < PRODUCERS; i++)
+    {
+        check(pthread_create(&producers[i], NULL, producer_thread_function, (void *)(intptr_t)i) == 0);
+    }
+
+    static uint8_t seen[PRODUCERS][RECORDS_PER_PRODUCER];
+    int next[PRODUCERS] = {0};
+    int out_of_order = 0;
+    int duplicates = 0;
+    memset(seen, 0, sizeof(seen));
+    for (int received = 0; received < PRODUCERS * RECORDS_PER_PRODUCER; received++)
+    {
+        int producer = -1;
+        int sequence = read_message(&producer);
+        check(sequence >= 0 && sequence < RECORDS_PER_PRODUCER && producer >= 0 && producer < PRODUCERS);
+        if (sequence < 0 || sequence >= RECORDS_PER_PRODUCER || producer < 0 || producer >= PRODUCERS)
+        {
+            // Let the producers still waiting for room finish without a reader.
+            set_overflow_policy(POLICY_DROP_NEWEST);
+            for (uint32_t i = 0; i < ring_count; i++)
+            {
+                futex_wake(&header->rings[i].released, INT_MAX);
+            }
+            break;
+        }
+        duplicates += seen[producer][sequence]++;
+        out_of_order += sequence != next[producer];
+        next[producer] = sequence + 1;
+    }
+
+    for (int i = 0; i < PRODUCERS; i++)
+    {
+        pthread_join(producers[i], NULL);
+    }
+    check(duplicates == 0);
+    check(ring_count > 1 || out_of_order == 0);
+    for (int i = 0; i < PRODUCERS; i++)
+    {
+        check(memchr(seen[i], 0, RECORDS_PER_PRODUCER) == NULL);
+    }
+    check(rings_empty());
+    close_rings();
+}
+
+/**
+ * Writes records that do not divide the ring, so that one of them would cross
+ * its end, and checks that the end is filled with a padding record and the
+ * record starts over at the beginning of the ring intact.
+ */
+static void test_padding_wrap()
+{
+    // Records of 1000 bytes, four fit before the end of a 4096 byte ring.
+    const int length = 1000 - sizeof(LogRecord) - strlen("RING");
+    open_rings(MIN_RING_SIZE, 1, POLICY_BLOCK);
+    Ring *ring = &header->rings[0];
+    LogMessage message;
+    LogMessage read;
+
+    for (int i = 0; i < 4; i++)
+    {
+        make_message(&message, 0, i, length);
+        write_log(&message);
+    }
+    check(atomic_load(&ring->write) == 4000);
+    for (int i = 0; i < 4; i++)
+    {
+        int producer;
+        check(read_message(&producer) == i);
+    }
+
+    make_message(&message, 0, 4, length);
+    write_log(&message);
+    LogRecord *padding = ring_record(ring, 4000);
+    check(padding->kind == LOG_RECORD_PADDING);
+    check(atomic_load(&padding->size) == MIN_RING_SIZE - 4000);
+    check(atomic_load(&ring->write) == MIN_RING_SIZE + 1000);
+
+    check(read_log(&read, 0) == 1);
+    check(read.length == message.length);
+    check(memcmp(read.log_message, message.log_message, message.length) == 0);
+    check(strcmp(read.log_tag, "RING") == 0);
+    check(atomic_load(&ring->read) == atomic_load(&ring->write));
+    check(atomic_load(&ring->released) == MIN_RING_SIZE + 1000);
+    check(read_log(&read, 0) == 0);
+    close_rings();
+}
+
+/**
+ * Writes three records more than a ring of 512 byte records holds with the
+ * policy, checks the drop counters of the process and reads back what is
+ * left.
+ *
+ * @return int - sequence number of the first record read back, -1 if the
+ *         records read back do not follow each other up to the last kept one
+ */
+static int overflow_ring(int policy, int *kept)
+{
+    const int length = 512 - sizeof(LogRecord) - strlen("RING");
+    const int capacity = MIN_RING_SIZE / 512;
+    open_rings(MIN_RING_SIZE, 1, policy);
+    LogMessage message;
+    for (int i = 0; i < capacity + 3; i++)
+    {
+        make_message(&message, 0, i, length);
+        write_log(&message);
+    }
+
+    int first = -1;
+    int producer;
+    int sequence;
+    *kept = 0;
+    while ((sequence = read_message(&producer)) != -1)
+    {
+        if (first == -1)
+        {
+            first = sequence;
+        }
+        if (sequence != first + *kept)
+        {
+            return -1;
+        }
+        (*kept)++;
+    }
+    return first;
+}
+
+static void test_drop_newest()
+{
+    int kept;
+    check(overflow_ring(POLICY_DROP_NEWEST, &kept) == 0);
+    check(kept == MIN_RING_SIZE / 512);
+    check(atomic_load(&own_producer()->dropped) == 3);
+    check(atomic_load(&own_producer()->overwritten) == 0);
+    close_rings();
+}
+
+static void test_overwrite_oldest()
+{
+    int kept;
+    check(overflow_ring(POLICY_OVERWRITE_OLDEST, &kept) == 3);
+    check(kept == MIN_RING_SIZE / 512);
+    check(atomic_load(&own_producer()->overwritten) == 3);
+    check(atomic_load(&own_producer()->dropped) == 0);
+
+    // The ring keeps working once the reader caught up.
+    LogMessage message;
+    int producer;
+    make_message(&message, 1, 42, 16);
+    write_log(&message);
+    check(read_message(&producer) == 42 && producer == 1);
+    close_rings();
+}
+
+/**
+ * Writes records with interleaved timestamps into different rings, as
+ * producers on different CPUs do, and checks that the reader merges them back
+ * in timestamp order.
+ */
+static void test_merge_by_timestamp()
+{
+    open_rings(MIN_RING_SIZE, 3, POLICY_BLOCK);
+    LogMessage message;
+    for (int i = 0; i < 12; i++)
+    {
+        make_message(&message, 0, i, 16);
+        message.log_timestamp_s = 1000 + i / 4;
+        message.log_timestamp_ns = i;
+        // The last ring stays empty, the reader must not wait for it.
+        write_record(&header->rings[(i * 5 / 3) % 2], &message);
+    }
+
+    for (int i = 0; i < 12; i++)
+    {
+        int producer;
+        check(read_message(&producer) == i);
+    }
+    check(rings_empty());
+    close_rings();
+}
+
+/**
+ * Reserves a record of the size at the write position of the ring and marks
+ * it pending for the producer without ever publishing it.
+ */
+static LogRecord *reserve_pending_record(Ring *ring, int pid, uint32_t size)
+{
+    uint32_t write = atomic_fetch_add(&ring->write, size);
+    LogRecord *record = ring_record(ring, write);
+    record->pid = pid;
+    atomic_store_explicit(&record->size, size | RECORD_PENDING, memory_order_release);
+    return record;
+}
+
+/**
+ * Lets a child reserve a record and exit before publishing it, and checks
+ * that the reader skips it and returns the record written after it.
+ */
+static void test_dead_producer()
+{
+    open_rings(MIN_RING_SIZE, 1, POLICY_BLOCK);
+    Ring *ring = &header->rings[0];
+    pid_t pid = fork();
+    check(pid != -1);
+    if (pid == 0)
+    {
+        reserve_pending_record(ring, getpid(), 512);
+        _exit(0);
+    }
+    waitpid(pid, NULL, 0);
+    check(atomic_load(&ring->write) == 512);
+
+    LogMessage message;
+    int producer;
+    make_message(&message, 0, 7, 16);
+    write_log(&message);
+    check(read_message(&producer) == 7);
+    check(read_log(&message, 0) == 0);
+    check(rings_empty());
+    check(atomic_load(&ring->released) == atomic_load(&ring->write));
+    close_rings();
+}
+
+/**
+ * Fills a ring behind a record its producer is still writing and checks that
+ * overwrite-oldest drops the new record instead of discarding the pending one.
+ */
+static void test_overwrite_pending()
+{
+    const int length = 512 - sizeof(LogRecord) - strlen("RING");
+    open_rings(MIN_RING_SIZE, 1, POLICY_OVERWRITE_OLDEST);
+    Ring *ring = &header->rings[0];
+    LogRecord *pending_record = reserve_pending_record(ring, getpid(), 512);
+    LogMessage message;
+    for (int i = 0; i < MIN_RING_SIZE / 512; i++)
+    {
+        make_message(&message, 0, i, length);
+        write_log(&message);
+    }
+    check(atomic_load(&own_producer()->dropped) == 1);
+    check(atomic_load(&own_producer()->overwritten) == 0);
+    check(atomic_load_explicit(&pending_record->size, memory_order_acquire) == (512 | RECORD_PENDING));
+    check(atomic_load(&ring->read) == 0);
+    close_rings();
+}
+
+/**
+ * Runs on a segment of its own, so a logger server running at the same time
+ * is not disturbed.
+ */
+int main()
+{
+    char name[64];
+    snprintf(name, sizeof(name), "/test_log_ring_%d", getpid());
+    setenv(LOGGER_SHM_VARIABLE, name, 1);
+    // A ring that lost track of its records hangs, fail instead of waiting forever.
+    alarm(60);
+
+    test_concurrent_producers(1);
+    test_concurrent_producers(4);
+    test_padding_wrap();
+    test_drop_newest();
+    test_overwrite_oldest();
+    test_merge_by_timestamp();
+    test_dead_producer();
+    test_overwrite_pending();
+
+    free(pending_messages);
+    return test_result("log_ring");
+}
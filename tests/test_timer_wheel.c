@@ -0,0 +1,84 @@
+#include "test.h"
+
+// Included to drive the wheel tick by tick without the timer thread.
+#include "../src/timer_wheel.c"
+
+#define TIMER_COUNT (sizeof(delays) / sizeof(delays[0]))
+
+typedef struct
+{
+    timer_entry entry;
+    long long fired_at;
+} test_timer;
+
+/**
+ * Delays in ticks around the boundaries of each level, where timers move
+ * down from one level to the next.
+ */
+static const uint64_t delays[] = {
+    0, 1, 63, 64, 65, 127, 128, 4095, 4096, 4097, 5000, 262143, 262144, 262145,
+    300000, 16777215, 16777216, 16777217, 20000000};
+
+/**
+ * Schedules a timer for each delay starting at the tick and checks that every
+ * one of them expires exactly at its tick.
+ */
+static void check_expiry(uint64_t start)
+{
+    test_timer timers[TIMER_COUNT];
+    uint64_t last = start;
+
+    memset(wheel, 0, sizeof(wheel));
+    current = start;
+    for (size_t i = 0; i < TIMER_COUNT; i++)
+    {
+        timers[i].entry.expires = start + delays[i];
+        timers[i].fired_at = -1;
+        insert_timer(&timers[i].entry);
+        last = timers[i].entry.expires > last ? timers[i].entry.expires : last;
+    }
+
+    size_t fired = 0;
+    while (current <= last)
+    {
+        uint64_t tick = current;
+        for (timer_entry *entry = advance_tick(); entry; entry = entry->next)
+        {
+            test_timer *timer = (test_timer *)entry;
+            check(timer->fired_at == -1);
+            timer->fired_at = tick;
+            fired++;
+        }
+    }
+
+    check(fired == TIMER_COUNT);
+    for (size_t i = 0; i < TIMER_COUNT; i++)
+    {
+        check(timers[i].fired_at == (long long)timers[i].entry.expires);
+        if (timers[i].fired_at != (long long)timers[i].entry.expires)
+        {
+            fprintf(stderr, "start %llu delay %llu fired at %lld\n",
+                    (unsigned long long)start, (unsigned long long)delays[i], timers[i].fired_at);
+        }
+    }
+}
+
+int main()
+{
+    check_expiry(0);
+    check_expiry(1);
+    check_expiry(63);
+    check_expiry(4000);
+    check_expiry(262100);
+    check_expiry(123456789);
+
+    // A timer already in the past expires on the next tick.
+    test_timer late = {.fired_at = -1};
+    memset(wheel, 0, sizeof(wheel));
+    current = 1000;
+    late.entry.expires = 10;
+    insert_timer(&late.entry);
+    check(advance_tick() == &late.entry);
+
+    return test_result("timer_wheel");
+}